@@ -0,0 +1,90 @@
+// Throughput of the element type conversions in tensor::copy_data_from, in GB/s of bytes
+// read plus bytes written, next to std::memcpy of the same number of bytes.
+//
+// build and run from the repository root, with the LibraryLink headers of Mathematica:
+//   LL=<Mathematica>/SystemFiles/IncludeFiles/C
+//   g++ -std=c++17 -O3 -march=native -pthread -I include -I $LL bench/conversion.cpp -o conversion
+//   ./conversion [elements] [threads]
+
+#include "wll_interface.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+
+constexpr int repeats = 10;
+
+template<typename Fn>
+double best_seconds(Fn fn)
+{
+    double best = 1e300;
+    for (int r = 0; r < repeats; ++r)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        const auto stop = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double>(stop - start).count());
+    }
+    return best;
+}
+
+template<typename T>
+T test_value(size_t i)
+{
+    if constexpr (wll::is_std_complex_v<T>)
+        return T(typename T::value_type(i % 100), typename T::value_type(i % 7));
+    else
+        return T(i % 100);
+}
+
+template<typename Src, typename Dest>
+void bench(const char* name, size_t count)
+{
+    wll::list<Src>  src({count}, wll::uninitialized);
+    wll::list<Dest> dest({count});
+    for (size_t i = 0; i < count; ++i)
+        src[i] = test_value<Src>(i);
+    std::vector<char> raw_src(count * sizeof(Src)), raw_dest(count * sizeof(Src));
+
+    const double bytes = double(count) * (sizeof(Src) + sizeof(Dest));
+    const double convert = best_seconds([&] { dest.copy_data_from(src.data()); });
+    const double copy    = best_seconds([&] { std::memcpy(raw_dest.data(), raw_src.data(), raw_src.size()); });
+    if (dest[count - 1] != static_cast<Dest>(src[count - 1]))
+        std::printf("%-30s wrong result\n", name);
+    std::printf("%-30s %8.2f GB/s   memcpy %8.2f GB/s\n", name,
+                bytes / convert * 1e-9, 2.0 * raw_src.size() / copy * 1e-9);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : size_t(1) << 24;
+    if (argc > 2)
+        wll::global_parallel_policy.num_threads = std::strtoull(argv[2], nullptr, 10);
+    std::printf("%zu elements, %zu threads\n", count, wll::get_thread_pool().size());
+
+    // same layout, memcpy
+    bench<double, double>("double -> double", count);
+    bench<int64_t, int64_t>("int64 -> int64", count);
+    bench<std::complex<double>, std::complex<double>>("complex<double> -> same", count);
+    // widening
+    bench<float, double>("float -> double", count);
+    bench<int32_t, int64_t>("int32 -> int64", count);
+    bench<int32_t, double>("int32 -> double", count);
+    bench<uint8_t, double>("uint8 -> double", count);
+    bench<int16_t, int64_t>("int16 -> int64", count);
+    bench<std::complex<float>, std::complex<double>>("complex<float> -> double", count);
+    // narrowing
+    bench<double, float>("double -> float", count);
+    bench<int64_t, int32_t>("int64 -> int32", count);
+    bench<double, int64_t>("double -> int64", count);
+    bench<int64_t, uint8_t>("int64 -> uint8", count);
+    bench<std::complex<double>, std::complex<float>>("complex<double> -> float", count);
+    return 0;
+}
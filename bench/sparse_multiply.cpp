@@ -0,0 +1,136 @@
+// Time of multiply and multiply_transpose for sparse_array<double, 2> against naive serial
+// loops over the same CSR arrays, with the largest difference of the results; both write into
+// outputs that are allocated once and reused.
+//
+// build and run from the repository root, with the LibraryLink headers of Mathematica:
+//   LL=<Mathematica>/SystemFiles/IncludeFiles/C
+//   g++ -std=c++17 -O3 -march=native -pthread -I include -I $LL bench/sparse_multiply.cpp -o sparse_multiply
+//   ./sparse_multiply [rows] [nonzeros] [threads]
+
+#include "wll_interface.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+constexpr int    repeats      = 5;
+constexpr size_t spmm_columns = 8;
+constexpr size_t band         = 4096; // nonzeros of a row are within band columns of the diagonal
+
+template<typename Fn>
+double best_ms(Fn fn)
+{
+    double best = 1e300;
+    for (int r = 0; r < repeats; ++r)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        const auto stop = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(stop - start).count());
+    }
+    return best;
+}
+
+double max_difference(const double* x, const double* y, size_t count)
+{
+    double diff = 0.0;
+    for (size_t i = 0; i < count; ++i)
+        diff = std::max(diff, std::abs(x[i] - y[i]));
+    return diff;
+}
+
+void report(const char* name, double library_ms, double naive_ms, double diff)
+{
+    std::printf("%-20s %9.2f ms   naive %9.2f ms   speedup %5.2f   max diff %g\n",
+                name, library_ms, naive_ms, naive_ms / library_ms, diff);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    const size_t m = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 20000000;
+    if (argc > 3)
+        wll::global_parallel_policy.num_threads = std::strtoull(argv[3], nullptr, 10);
+
+    std::mt19937_64 gen(1);
+    wll::sparse_builder<double, 2> builder({n, n});
+    builder.reserve(m);
+    for (size_t i = 0; i < m; ++i)
+    {
+        const size_t row = gen() % n;
+        builder.add({row, (row + gen() % band) % n}, double(gen() % 100) / 10);
+    }
+    const auto a = builder.finalize();
+
+    const size_t* row_idx = a.row_indices_pointer();
+    const auto*   columns = a.columns_pointer();
+    const double* values  = a.values_pointer();
+    std::printf("%zu x %zu, %zu nonzeros, %zu threads\n", n, n, row_idx[n],
+                wll::get_thread_pool().size());
+    wll::list<double>   x({n});
+    wll::matrix<double> xs({n, spmm_columns});
+    for (size_t i = 0; i < n; ++i)
+        x[i] = double(i % 13);
+    for (size_t i = 0; i < xs.size(); ++i)
+        xs[i] = double(i % 11);
+
+    // y = a.x
+    std::vector<double> y(n);
+    auto naive_mv = [&]
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            double sum = 0.0;
+            for (size_t k = row_idx[i]; k < row_idx[i + 1]; ++k)
+                sum += values[k] * x[size_t(columns[k][0] - 1)];
+            y[i] = sum;
+        }
+    };
+    const double mv_naive = best_ms(naive_mv);
+    wll::list<double> y_lib({n}, wll::uninitialized);
+    const double mv = best_ms([&] { wll::multiply(a, x, y_lib); });
+    report("spmv", mv, mv_naive, max_difference(y_lib.data(), y.data(), n));
+
+    // y = transpose(a).x
+    auto naive_mtv = [&]
+    {
+        std::fill(y.begin(), y.end(), 0.0);
+        for (size_t i = 0; i < n; ++i)
+            for (size_t k = row_idx[i]; k < row_idx[i + 1]; ++k)
+                y[size_t(columns[k][0] - 1)] += values[k] * x[i];
+    };
+    const double mtv_naive = best_ms(naive_mtv);
+    const double mtv = best_ms([&] { wll::multiply_transpose(a, x, y_lib); });
+    report("spmv transpose", mtv, mtv_naive, max_difference(y_lib.data(), y.data(), n));
+
+    // ys = a.xs
+    std::vector<double> ys(n * spmm_columns);
+    auto naive_mm = [&]
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            double* dest = ys.data() + i * spmm_columns;
+            std::fill(dest, dest + spmm_columns, 0.0);
+            for (size_t k = row_idx[i]; k < row_idx[i + 1]; ++k)
+            {
+                const double* src = xs.data() + size_t(columns[k][0] - 1) * spmm_columns;
+                for (size_t j = 0; j < spmm_columns; ++j)
+                    dest[j] += values[k] * src[j];
+            }
+        }
+    };
+    const double mm_naive = best_ms(naive_mm);
+    wll::matrix<double> ys_lib({n, spmm_columns}, wll::uninitialized);
+    const double mm = best_ms([&] { wll::multiply(a, xs, ys_lib); });
+    report("spmm", mm, mm_naive, max_difference(ys_lib.data(), ys.data(), ys.size()));
+    return 0;
+}
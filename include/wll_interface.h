@@ -8,18 +8,45 @@
 #include <cassert>
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <complex>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <exception>
 #include <initializer_list>
 #include <iterator>
+#include <memory>
+#include <mutex>
 #include <numeric>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <tuple>
 #include <type_traits>
 #include <utility>
 #include <vector>
 
+#if defined(_WIN32)
+#include <malloc.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define WLL_HAS_STREAMING_STORE
+#endif
+
 #include "WolframLibrary.h"
 #include "WolframSparseLibrary.h"
 
@@ -91,6 +118,11 @@ struct library_function_error : library_error
     explicit library_function_error(std::string message ={}) :
         library_error(LIBRARY_FUNCTION_ERROR, std::move(message)) {}
 };
+struct library_abort_error : library_error
+{
+    explicit library_abort_error(std::string message ={}) :
+        library_error(LIBRARY_FUNCTION_ERROR, std::move(message)) {}
+};
 
 struct log_stringstream_t
 {
@@ -114,13 +146,37 @@ struct log_stringstream_t
 };
 
 
-WolframLibraryData global_lib_data;
+// globals are inline so that the header can be included by more than one source file of a
+// library; all but one of them define WLL_DISABLE_ENTRY_POINTS
+inline WolframLibraryData global_lib_data;
 using sparse_fn_lib_t = decltype(global_lib_data->sparseLibraryFunctions);
-sparse_fn_lib_t    global_sparse_fn;
+inline sparse_fn_lib_t    global_sparse_fn;
+
+inline exception_status   global_exception;
+inline log_stringstream_t global_log;
+inline std::string        global_string_result;
+
+
+struct allocation_policy
+{
+    size_t alignment             = 64;              // power of two, in bytes
+    size_t huge_page_threshold   = size_t(1) << 22; // request huge pages from this size up
+    size_t first_touch_threshold = size_t(1) << 24; // zero-fill owned tensors in parallel from this size up
+    bool   numa_interleave       = false;           // spread pages of blocks from first_touch_threshold
+                                                    // up over all NUMA nodes, Linux only
+    // applies to owned tensors; tensors created with the default memory_type::result on the
+    // kernel thread are allocated and placed by the kernel, except that blocks from
+    // first_touch_threshold up stay owned when numa_interleave is set
+};
 
-exception_status   global_exception;
-log_stringstream_t global_log;
-std::string        global_string_result;
+inline allocation_policy global_allocation_policy;
+
+// tag for constructors that leave the data uninitialized
+struct uninitialized_t
+{
+    explicit constexpr uninitialized_t() = default;
+};
+constexpr uninitialized_t uninitialized{};
 
 
 #ifdef NDEBUG
@@ -131,886 +187,4269 @@ std::string        global_string_result;
 #define WLL_ASSERT(expr) assert((expr))
 #endif
 
+#if defined(_MSC_VER)
+#define WLL_RESTRICT __restrict
+#else
+#define WLL_RESTRICT __restrict__
+#endif
 
-template<typename LinkType, typename UserType>
-struct is_same_layout :
-    std::false_type {};
-template<typename UserType>
-struct is_same_layout<mint, UserType> :
-    std::bool_constant<std::is_integral_v<UserType> && sizeof(mint) == sizeof(UserType)> {};
-template<>
-struct is_same_layout<mreal, double> :
-    std::true_type {};
-template<>
-struct is_same_layout<mcomplex, std::complex<double>> :
-    std::true_type {};
-template<typename LinkType, typename UserType>
-constexpr bool is_same_layout_v = is_same_layout<LinkType, UserType>::value;
-
-template<typename Complex>
-struct is_std_complex :
-    std::false_type {};
-template<typename T>
-struct is_std_complex<std::complex<T>> :
-    std::true_type {};
-template<typename Complex>
-constexpr bool is_std_complex_v = is_std_complex<Complex>::value;
 
-template<typename Complex>
-struct complex_value
-{
-    using type = void;
-};
-template<typename T>
-struct complex_value<std::complex<T>>
+// set the NUMA policy of the pages in [ptr, ptr + bytes) to interleave over the allowed nodes;
+// advisory, failures are ignored as with madvise
+inline void _numa_interleave(void* ptr, size_t bytes) noexcept
 {
-    using type = T;
-};
-template<typename Complex>
-using complex_value_t = typename complex_value<Complex>::type;
-
-template<typename>
-constexpr bool _always_false_v = false;
-
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_get_mempolicy)
+    constexpr int mpol_interleave      = 3; // MPOL_INTERLEAVE from <numaif.h>
+    constexpr int mpol_f_mems_allowed  = 4; // MPOL_F_MEMS_ALLOWED from <numaif.h>
+    unsigned long node_mask = 0;
+    const unsigned long max_node = sizeof(node_mask) * 8 + 1;
+    if (syscall(SYS_get_mempolicy, nullptr, &node_mask, max_node, nullptr, mpol_f_mems_allowed) != 0)
+        return;
+
+    const uintptr_t page_size = uintptr_t(sysconf(_SC_PAGESIZE));
+    const uintptr_t first = (reinterpret_cast<uintptr_t>(ptr) + page_size - 1) & ~(page_size - 1);
+    const uintptr_t last  = reinterpret_cast<uintptr_t>(ptr) + bytes;
+    if (first < last)
+        syscall(SYS_mbind, first, last - first, mpol_interleave, &node_mask, max_node, 0u);
+#else
+    (void)ptr;
+    (void)bytes;
+#endif
+}
 
-template<size_t Size>
-size_t _flattened_size(const std::array<size_t, Size>& dims) noexcept
+// allocation of memory owned by wll, i.e. memory_type::owned tensors and sparse arrays;
+// outside Windows, blocks are over-allocated with malloc or calloc and aligned by hand, with
+// the pointer to free stored just before the block, so that zero-filled blocks come from
+// calloc: fresh pages from the system are zero already and stay untouched until first use,
+// and only memory the heap reuses is cleared
+inline void* _owned_malloc(size_t bytes, bool zero_fill)
 {
-    size_t size = 1;
-    for (size_t d : dims) size *= d;
-    return size;
+    constexpr size_t huge_page_size = size_t(1) << 21;
+    const allocation_policy& policy = global_allocation_policy;
+    WLL_ASSERT((policy.alignment & (policy.alignment - 1)) == 0); // alignment should be a power of 2
+
+    const bool use_huge_page = (bytes >= policy.huge_page_threshold);
+    size_t alignment = std::max(policy.alignment, alignof(std::max_align_t));
+    if (use_huge_page)
+        alignment = std::max(alignment, huge_page_size);
+    bytes = std::max(bytes, size_t(1));
+    const bool interleave = policy.numa_interleave && bytes >= policy.first_touch_threshold;
+
+    void* ptr    = nullptr;
+    bool  zeroed = false;
+#if defined(_WIN32)
+    ptr = _aligned_malloc(bytes, alignment);
+#else
+    const size_t padded = bytes + alignment + sizeof(void*);
+    if (padded < bytes)
+        return nullptr;
+    // interleaved blocks are cleared after mbind, which only places pages not touched yet
+    const bool use_calloc = zero_fill && !interleave;
+    void* raw = use_calloc ? std::calloc(padded, 1) : std::malloc(padded);
+    if (raw != nullptr)
+    {
+        const uintptr_t first = reinterpret_cast<uintptr_t>(raw) + sizeof(void*);
+        ptr = reinterpret_cast<void*>((first + alignment - 1) & ~uintptr_t(alignment - 1));
+        static_cast<void**>(ptr)[-1] = raw;
+        zeroed = use_calloc;
+    }
+#endif
+    if (ptr == nullptr)
+        return nullptr;
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (use_huge_page)
+        madvise(ptr, bytes, MADV_HUGEPAGE);
+#endif
+    if (interleave)
+        _numa_interleave(ptr, bytes); // before any page is touched
+    if (zero_fill && !zeroed)
+        std::memset(ptr, 0, bytes);
+    return ptr;
 }
 
-template<size_t Rank, typename T>
-std::array<size_t, Rank> _convert_to_dims_array(std::initializer_list<T> dims)
+inline void _owned_free(void* ptr) noexcept
 {
-    static_assert(std::is_integral_v<T>, "dimensions should be of integral types");
-    WLL_ASSERT(dims.size() == Rank);   // dims should have size equal to the rank
-    std::array<size_t, Rank> dims_array;
-    std::copy_n(dims.begin(), Rank, dims_array.begin());
-    return dims_array;
+#if defined(_WIN32)
+    _aligned_free(ptr);
+#else
+    if (ptr != nullptr)
+        std::free(static_cast<void**>(ptr)[-1]);
+#endif
 }
 
-template<typename X, typename Y>
-auto _add_if_negative(X val_x, Y val_y)
+// bump allocator for short-lived data, reset after each call of library_eval;
+// blocks are kept in a pool by size class, so steady-state calls do not touch the heap.
+// scratch_arena is not thread-safe and should only be used on the calling thread.
+class scratch_arena
 {
-    if constexpr (std::is_signed_v<X>)
-        if (val_x < X(0))
-            return Y(val_x) + val_y;
-    return Y(val_x);
-}
+public:
+    struct statistics
+    {
+        size_t allocations    = 0; // allocations served by the arena
+        size_t heap_blocks    = 0; // blocks allocated from the heap
+        size_t pooled_blocks  = 0; // blocks reused from the pool
+        size_t bytes_in_use   = 0;
+        size_t bytes_reserved = 0;
+    };
 
+    static constexpr size_t _min_size_class = 20; // 1 MiB
+    static constexpr size_t _num_size_class = 64;
 
-template<typename Target>
-struct _mtype_cast_impl
-{
-    template<typename Value>
-    constexpr Target operator()(const Value& value) noexcept
+    scratch_arena() = default;
+    scratch_arena(const scratch_arena&) = delete;
+    scratch_arena& operator=(const scratch_arena&) = delete;
+
+    ~scratch_arena()
     {
-        return static_cast<Target>(value);
+        this->release();
     }
 
-    constexpr Target operator()(const mcomplex& value)
+    void* allocate(size_t bytes, bool zero_fill = false)
     {
-        throw library_type_error(WLL_CURRENT_FUNCTION + "\ncannot convert from mcomplex");
-        return Target{};
+        const size_t alignment = std::max(global_allocation_policy.alignment, alignof(std::max_align_t));
+        bytes = std::max(bytes, size_t(1));
+        size_t offset = (offset_ + alignment - 1) & ~(alignment - 1);
+        if (blocks_.empty() || offset + bytes > (size_t(1) << blocks_.back().size_class_))
+        {
+            this->_next_block(bytes);
+            offset = 0;
+        }
+        void* ptr = blocks_.back().ptr_ + offset;
+        offset_ = offset + bytes;
+        ++stats_.allocations;
+        stats_.bytes_in_use += bytes;
+        if (zero_fill)
+            std::memset(ptr, 0, bytes);
+        return ptr;
     }
 
-    template<typename T>
-    constexpr Target operator()(const std::complex<T>& value)
+    // invalidate all allocations, and return the blocks to the pool
+    void reset() noexcept
     {
-        throw library_type_error(WLL_CURRENT_FUNCTION + "\ncannot convert from std::complex<T>");
-        return Target{};
+        for (const auto& block : blocks_)
+            pool_[block.size_class_].push_back(block.ptr_);
+        blocks_.clear();
+        offset_ = 0;
+        stats_.bytes_in_use = 0;
     }
-};
-template<typename T>
-struct _mtype_cast_impl<std::complex<T>>
-{
-    template<typename Value>
-    constexpr std::complex<T> operator()(const Value& value) noexcept
+
+    // reset, and return the pooled blocks to the heap
+    void release() noexcept
     {
-        return std::complex<T>(static_cast<T>(value));
+        this->reset();
+        for (auto& blocks : pool_)
+        {
+            for (char* ptr : blocks)
+                _owned_free(ptr);
+            blocks.clear();
+        }
+        stats_.bytes_reserved = 0;
     }
 
-    constexpr std::complex<T> operator()(const mcomplex& value) noexcept
+    [[nodiscard]] statistics get_statistics() const noexcept
     {
-        return std::complex<T>(static_cast<T>(mcreal(value)),
-                               static_cast<T>(mcimag(value)));
+        return stats_;
     }
 
-    template<typename U>
-    constexpr std::complex<T> operator()(const std::complex<U>& value) noexcept
+private:
+    struct _block
     {
-        return std::complex<T>(static_cast<T>(value.real()),
-                               static_cast<T>(value.imag()));
+        char*  ptr_;
+        size_t size_class_;
+    };
+
+    void _next_block(size_t bytes)
+    {
+        size_t size_class = _min_size_class;
+        while ((size_t(1) << size_class) < bytes)
+            ++size_class;
+        WLL_ASSERT(size_class < _num_size_class);
+
+        char* ptr = nullptr;
+        if (!pool_[size_class].empty())
+        {
+            ptr = pool_[size_class].back();
+            pool_[size_class].pop_back();
+            ++stats_.pooled_blocks;
+        }
+        else
+        {
+            ptr = reinterpret_cast<char*>(_owned_malloc(size_t(1) << size_class, false));
+            if (ptr == nullptr)
+                throw library_memory_error(WLL_CURRENT_FUNCTION + "\nmemory allocation failed.");
+            ++stats_.heap_blocks;
+            stats_.bytes_reserved += size_t(1) << size_class;
+        }
+        blocks_.push_back({ptr, size_class});
     }
+
+    std::vector<_block> blocks_{};
+    std::array<std::vector<char*>, _num_size_class> pool_{};
+    size_t     offset_ = 0;
+    statistics stats_{};
 };
-template<>
-struct _mtype_cast_impl<mcomplex>
+
+inline scratch_arena global_scratch;
+
+// std allocator with the same policy as owned tensors, or drawing from a scratch_arena;
+// default-initializes on resize instead of zero-filling
+template<typename T>
+struct owned_allocator
 {
-    template<typename Value>
-    constexpr mcomplex operator()(const Value& value) noexcept
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap            = std::true_type;
+
+    owned_allocator() noexcept = default;
+    explicit owned_allocator(scratch_arena* arena) noexcept :
+        arena_{arena} {}
+    template<typename U>
+    owned_allocator(const owned_allocator<U>& other) noexcept :
+        arena_{other.arena_} {}
+
+    T* allocate(size_t n)
     {
-        mcomplex ret;
-        mcreal(ret) = static_cast<mreal>(value);
-        mcimag(ret) = mreal{};
-        return ret;
+        if (arena_ != nullptr)
+            return reinterpret_cast<T*>(arena_->allocate(n * sizeof(T)));
+        void* ptr = _owned_malloc(n * sizeof(T), false);
+        if (ptr == nullptr)
+            throw library_memory_error(WLL_CURRENT_FUNCTION + "\nmemory allocation failed.");
+        return reinterpret_cast<T*>(ptr);
     }
 
-    constexpr mcomplex operator()(const mcomplex& value) noexcept
+    void deallocate(T* ptr, size_t) noexcept
     {
-        return value;
+        if (arena_ == nullptr)
+            _owned_free(ptr);
     }
 
-    template<typename T>
-    constexpr mcomplex operator()(const std::complex<T>& value) noexcept
+    template<typename U>
+    void construct(U* ptr) noexcept(std::is_nothrow_default_constructible_v<U>)
     {
-        mcomplex ret;
-        mcreal(ret) = static_cast<mreal>(value.real());
-        mcimag(ret) = static_cast<mreal>(value.imag());
-        return ret;
+        ::new(static_cast<void*>(ptr)) U;
+    }
+
+    template<typename U, typename... Args>
+    void construct(U* ptr, Args&&... args)
+    {
+        ::new(static_cast<void*>(ptr)) U(std::forward<Args>(args)...);
     }
+
+    template<typename U>
+    bool operator==(const owned_allocator<U>& other) const noexcept { return arena_ == other.arena_; }
+    template<typename U>
+    bool operator!=(const owned_allocator<U>& other) const noexcept { return arena_ != other.arena_; }
+
+    scratch_arena* arena_ = nullptr;
 };
 
-template<typename Target, typename Value>
-constexpr Target _mtype_cast(const Value& value)
+template<typename T>
+owned_allocator<T> scratch_allocator() noexcept
 {
-    return _mtype_cast_impl<Target>()(value);
+    return owned_allocator<T>(&global_scratch);
 }
 
-bool operator==(const mcomplex& a, const mcomplex& b)
-{
-    return (mcreal(a) == mcreal(b)) && (mcimag(a) == mcimag(b));
-}
-bool operator!=(const mcomplex& a, const mcomplex& b)
-{
-    return !(a == b);
-}
+template<typename T>
+using _owned_vector = std::vector<T, owned_allocator<T>>;
 
-template<typename SrcType, typename DestType>
-inline void _data_copy_n(const SrcType* src_ptr, size_t count, DestType* dest_ptr)
+
+// cooperative cancellation of long computations; the calling thread polls AbortQ at most
+// once per poll interval, other threads only read the flag that the poll sets.
+// check() is meant to be called per row or per chunk, not per element.
+class abort_token
 {
-    if (count > 0)
+public:
+    using _clock_t = std::chrono::steady_clock;
+
+    // true if the computation should stop
+    bool check() noexcept
     {
-        WLL_ASSERT(src_ptr != nullptr && dest_ptr != nullptr);
-        WLL_ASSERT((void*)src_ptr != (void*)dest_ptr); // cannot copy to itself
-        for (size_t i = 0; i < count; ++i)
-            dest_ptr[i] = _mtype_cast<DestType>(src_ptr[i]);
+        if (flag_.load(std::memory_order_relaxed))
+            return true;
+        if (std::this_thread::get_id() == caller_)
+            return this->_poll();
+        return false;
     }
-}
-
-template<size_t Rank>
-struct _index_array
-{
-    using _idx_t = std::array<size_t, Rank>;
 
-    explicit _index_array(const _idx_t& idx) noexcept : idx_{idx} {}
+    void throw_if_aborted()
+    {
+        if (this->check())
+            throw library_abort_error(WLL_CURRENT_FUNCTION + "\ncomputation aborted.");
+    }
 
-    template<typename Value>
-    std::pair<_idx_t, Value> operator=(const Value& value) const noexcept
+    [[nodiscard]] bool requested() const noexcept
     {
-        return {idx_, value};
+        return flag_.load(std::memory_order_relaxed);
     }
 
-    _idx_t idx_;
-};
+    void request() noexcept
+    {
+        flag_.store(true, std::memory_order_relaxed);
+    }
 
-template<typename... Indices>
-_index_array<sizeof...(Indices)> pos(const Indices&... indices)
-{
-    return std::array<size_t, sizeof...(Indices)>({size_t(indices)...});
-}
+    // clear the flag, and make the current thread the one that polls AbortQ
+    void reset() noexcept
+    {
+        flag_.store(false, std::memory_order_relaxed);
+        caller_    = std::this_thread::get_id();
+        last_poll_ = _clock_t::now();
+    }
 
+    void set_poll_interval(_clock_t::duration interval) noexcept
+    {
+        poll_interval_ = interval;
+    }
 
-#define MType_Void -1
+    // true on the thread of the last reset, or on any thread before the first one
+    [[nodiscard]] bool is_caller_thread() const noexcept
+    {
+        return caller_ == std::thread::id{} || caller_ == std::this_thread::get_id();
+    }
 
-template<typename T>
-struct derive_tensor_data_type
-{
-    using strict_type =
-        std::conditional_t<is_same_layout_v<mint, T>, mint,
-        std::conditional_t<is_same_layout_v<mreal, T>, mreal,
-        std::conditional_t<is_same_layout_v<mcomplex, T>, mcomplex, void>>>;
-    using convert_type =
-        std::conditional_t<std::is_integral_v<T>, mint,
-        std::conditional_t<std::is_floating_point_v<T>, mreal,
-        std::conditional_t<is_std_complex_v<T>, mcomplex, void>>>;
-    static constexpr int strict_type_v =
-        std::is_same_v<strict_type, mint> ? MType_Integer :
-        std::is_same_v<strict_type, mreal> ? MType_Real :
-        std::is_same_v<strict_type, mcomplex> ? MType_Complex : MType_Void;
-    static constexpr int convert_type_v =
-        std::is_same_v<convert_type, mint> ? MType_Integer :
-        std::is_same_v<convert_type, mreal> ? MType_Real :
-        std::is_same_v<convert_type, mcomplex> ? MType_Complex : MType_Void;
-};
+private:
+    bool _poll() noexcept
+    {
+        const auto now = _clock_t::now();
+        if (now - last_poll_ < poll_interval_)
+            return false;
+        last_poll_ = now;
+        if (global_lib_data == nullptr || !global_lib_data->AbortQ())
+            return false;
+        this->request();
+        return true;
+    }
 
-enum memory_type
-{
-    // who has resource    memory managed by
-    empty,  // -                   -
-    owned,  // wll::tensor         malloc/free
-    proxy,  // kernel              -
-    manual, // wll::tensor         MTensor_new/MTensor_free
-    shared  // kernel/wll::tensor  MTensor_disown
+    std::atomic<bool>     flag_{false};
+    std::thread::id       caller_{};
+    _clock_t::time_point  last_poll_{};
+    _clock_t::duration    poll_interval_ = std::chrono::milliseconds(10);
 };
 
+// reset at the beginning of each call of library_eval
+inline abort_token global_abort;
 
-template<typename T, size_t Rank>
-struct tensor_init_data
-{
-    using type = std::initializer_list<typename tensor_init_data<T, Rank - 1>::type>;
-};
-template<typename T>
-struct tensor_init_data<T, 0>
+struct parallel_policy
 {
-    using type = T;
+    size_t num_threads         = 0;               // threads taking part in parallel loops, 0 for all hardware threads
+    size_t bulk_copy_threshold = size_t(1) << 24; // bytes, larger copies are split across threads and bypass the cache
 };
-template<typename T, size_t Rank>
-using tensor_init_data_t = typename tensor_init_data<T, Rank>::type;
 
+inline parallel_policy global_parallel_policy;
 
-template<typename T, size_t Rank>
-class tensor
+// fixed set of worker threads for parallel loops; the calling thread takes part in every loop.
+// [first, last) is cut into chunks of grain indices, each participant starts on a contiguous
+// block of chunks and, once done, steals half of the chunks left to another participant.
+// Nested loops run inline on the thread that issues them.
+class thread_pool
 {
 public:
-    using value_type   = T;
-    static constexpr size_t _rank = Rank;
-    using _ptr_t       = value_type*;
-    using _const_ptr_t = const value_type*;
-    using _dims_t      = std::array<size_t, _rank>;
-    using _init_dims_t = std::initializer_list<size_t>;
-    using _init_data_t = tensor_init_data_t<value_type, _rank>;
-    static_assert(_rank > 0);
-
-    template<typename U, size_t URank>
-    friend class tensor;
-
-    tensor() noexcept = default;
+    static constexpr size_t _chunks_per_thread = 8;  // with grain == 0
+    static constexpr size_t _spin_count        = 2048; // polls before a worker sleeps
 
-    tensor(MTensor mtensor, memory_type access) :
-        mtensor_{mtensor}, access_{access}
+    explicit thread_pool(size_t num_threads = 0)
     {
-        auto mtensor_rank = global_lib_data->MTensor_getRank(mtensor);
-        WLL_ASSERT(_rank == mtensor_rank);
-        WLL_ASSERT(access_ == memory_type::owned ||
-                   access_ == memory_type::proxy ||
-                   access_ == memory_type::shared);
-
-        const mint* dims_ptr = global_lib_data->MTensor_getDimensions(mtensor);
-        std::copy_n(dims_ptr, _rank, dims_.begin());
-        size_ = global_lib_data->MTensor_getFlattenedLength(mtensor);
-
-        void* src_ptr = nullptr;
-        bool  do_copy = false;
-        int   mtype   = int(global_lib_data->MTensor_getType(mtensor));
-        WLL_ASSERT(mtype == MType_Integer || mtype == MType_Real || mtype == MType_Complex);
-
-        if (mtype == MType_Integer)
-        {
-            src_ptr = reinterpret_cast<void*>(global_lib_data->MTensor_getIntegerData(mtensor));
-            do_copy = !is_same_layout_v<mint, value_type>;
-        }
-        else if (mtype == MType_Real)
-        {
-            src_ptr = reinterpret_cast<void*>(global_lib_data->MTensor_getRealData(mtensor));
-            do_copy = !is_same_layout_v<mreal, value_type>;
-        }
-        else // mtype == MType_Complex
-        {
-            src_ptr = reinterpret_cast<void*>(global_lib_data->MTensor_getComplexData(mtensor));
-            do_copy = !is_same_layout_v<mcomplex, value_type>;
-        }
-
-        if (access_ == memory_type::owned)
-            do_copy = true; // do copy anyway
-
-        if (do_copy)
-        {
-            WLL_ASSERT(access_ == memory_type::owned ||
-                       access_ == memory_type::proxy);
-            mtensor_ = nullptr;
-            access_  = memory_type::owned; // *this will own data after copy
-            ptr_ = reinterpret_cast<_ptr_t>(malloc(size_ * sizeof(value_type)));
-            if (ptr_ == nullptr)
-                throw library_memory_error(WLL_CURRENT_FUNCTION + "\nmalloc failed when copying data.");
-            if (mtype == MType_Integer)
-                _data_copy_n(reinterpret_cast<mint*>(src_ptr), size_, ptr_);
-            else if (mtype == MType_Real)
-                _data_copy_n(reinterpret_cast<mreal*>(src_ptr), size_, ptr_);
-            else // mtype == MType_Complex
-                _data_copy_n(reinterpret_cast<mcomplex*>(src_ptr), size_, ptr_);
-        }
-        else // do_copy == false
+        if (num_threads == 0)
+            num_threads = std::max(size_t(std::thread::hardware_concurrency()), size_t(1));
+        slots_ = std::make_unique<_slot[]>(num_threads);
+        workers_.reserve(num_threads - 1);
+        try
         {
-            WLL_ASSERT(access_ == memory_type::proxy ||
-                       access_ == memory_type::shared);
-            ptr_ = reinterpret_cast<_ptr_t>(src_ptr);
+            for (size_t i = 1; i < num_threads; ++i)
+                workers_.emplace_back([this, i] { this->_worker_loop(i); });
         }
-    }
-
-    explicit tensor(_dims_t dims, memory_type access = memory_type::owned) :
-        dims_{dims}, size_{_flattened_size(dims)}, access_{access}
-    {
-        WLL_ASSERT(access_ == memory_type::owned ||
-                   access_ == memory_type::manual);
-        if (access_ == memory_type::owned)
+        catch (...)
         {
-            ptr_ = reinterpret_cast<_ptr_t>(calloc(size_, sizeof(value_type)));
-            if (ptr_ == nullptr)
-                throw library_memory_error(WLL_CURRENT_FUNCTION + "\ncalloc failed, access_ == owned.");
-        }
-        else // access_ == memory_type::manual
-        {
-            //throw library_dimension_error(std::to_string(dims[0]));
-            constexpr int mtype = derive_tensor_data_type<value_type>::strict_type_v;
-            if (mtype == MType_Void)
-                throw library_type_error(WLL_CURRENT_FUNCTION + "\nvalue_type cannot be strictly matched to any MType.");
-            int err = global_lib_data->MTensor_new(
-                mtype, _rank, reinterpret_cast<mint*>(dims_.data()), &mtensor_);
-            if (err != LIBRARY_NO_ERROR)
-                throw library_error(err, WLL_CURRENT_FUNCTION + "\nMTensor_new() failed.");
-            if constexpr (mtype == MType_Integer)
-                ptr_ = reinterpret_cast<_ptr_t>(global_lib_data->MTensor_getIntegerData(mtensor_));
-            else if constexpr (mtype == MType_Real)
-                ptr_ = reinterpret_cast<_ptr_t>(global_lib_data->MTensor_getRealData(mtensor_));
-            else // mtype == MType_Complex
-                ptr_ = reinterpret_cast<_ptr_t>(global_lib_data->MTensor_getComplexData(mtensor_));
+            this->_stop();
+            throw;
         }
     }
 
-    tensor(_init_dims_t dims, memory_type access = memory_type::owned) :
-        tensor(_convert_to_dims_array<_rank>(dims), access) {}
-
-    tensor(_dims_t dims, const _init_data_t& data, memory_type access = memory_type::owned) :
-        tensor(dims, access)
-    {
-        this->_fill_init_data(data);
-    }
-
-    tensor(_init_dims_t dims, const _init_data_t& data, memory_type access = memory_type::owned) :
-        tensor(_get_init_dims(dims, data), data, access)
-    {
-        this->_fill_init_data(data);
-    }
-
-    tensor(const tensor& other) :
-        dims_{other.dims_}, size_{other.size_}, access_{memory_type::owned}
-    {
-        ptr_ = reinterpret_cast<_ptr_t>(malloc(size_ * sizeof(value_type)));
-        if (ptr_ == nullptr)
-            throw library_memory_error(WLL_CURRENT_FUNCTION + "\nmalloc failed when copying data.");
-        _data_copy_n(other.ptr_, size_, ptr_);
-    }
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
 
-    tensor(tensor&& other) noexcept :
-        dims_{other.dims_}, size_{other.size_}
+    ~thread_pool()
     {
-        std::swap(ptr_, other.ptr_);
-        std::swap(access_, other.access_);
-        std::swap(mtensor_, other.mtensor_);
+        this->_stop();
     }
 
-    template<typename U>
-    explicit tensor(const tensor<U, _rank>& other) :
-        dims_{other.dims_}, size_{other.size_}, access_{memory_type::owned}
+    // number of threads taking part in a loop, including the calling thread
+    [[nodiscard]] size_t size() const noexcept
     {
-        ptr_ = reinterpret_cast<_ptr_t>(malloc(size_ * sizeof(value_type)));
-        if (ptr_ == nullptr)
-            throw library_memory_error(WLL_CURRENT_FUNCTION + "\nmalloc failed when copying data.");
-        _data_copy_n(other.ptr_, size_, ptr_);
+        return workers_.size() + 1;
     }
 
-    template<typename U>
-    explicit tensor(tensor<U, _rank>&& other) :
-        dims_{other.dims_}, size_{other.size_}, access_{memory_type::owned}
+    // true inside fn of a loop, and always on worker threads
+    [[nodiscard]] static bool in_parallel_region() noexcept
     {
-        ptr_ = reinterpret_cast<_ptr_t>(malloc(size_ * sizeof(value_type)));
-        if (ptr_ == nullptr)
-            throw library_memory_error(WLL_CURRENT_FUNCTION + "\nmalloc failed when copying data.");
-        _data_copy_n(other.ptr_, size_, ptr_);
+        return _in_parallel_region;
     }
 
-    tensor& operator=(const tensor& other)
+    // call fn(chunk_first, chunk_last) for chunks covering [first, last), concurrently;
+    // the first exception thrown by fn is rethrown after all threads are done, and
+    // library_abort_error is thrown if an abort made the threads skip any chunk, but not
+    // if every chunk ran to completion
+    template<typename Fn>
+    void parallel_for(size_t first, size_t last, Fn&& fn, size_t grain = 0)
     {
-        if(this == &other) return *this;
-        WLL_ASSERT(other.access_ != memory_type::empty); // other is empty
-        WLL_ASSERT(this->access_ != memory_type::empty); // *this is empty
-        if (this->ptr_ != other.ptr_)
+        if (first >= last)
+            return;
+        const size_t count = last - first;
+        const size_t num_chunks = this->_num_chunks(count, grain);
+        if (num_chunks == 1 || this->size() == 1 || _in_parallel_region)
         {
-            if (!(this->_has_same_dims(other.dims_.data())))
-                throw library_dimension_error(WLL_CURRENT_FUNCTION + "\ntensors have different dimensions.");
-            _data_copy_n(other.ptr_, size_, ptr_);
+            fn(first, last);
+            return;
         }
-        return *this;
-    }
 
-    tensor& operator=(tensor&& other)
-    {
-        if(this == &other) return *this;
-        WLL_ASSERT(other.access_ != memory_type::empty); // other is empty
-        WLL_ASSERT(this->access_ != memory_type::empty); // *this is empty
-        if (this->ptr_ != other.ptr_)
+        std::lock_guard<std::mutex> submit_lock(submit_mutex_);
+        job_ = _job{&_invoke_chunk<std::remove_reference_t<Fn>>,
+                    const_cast<void*>(reinterpret_cast<const void*>(std::addressof(fn))),
+                    first, last, grain};
+        for (size_t i = 0; i < this->size(); ++i)
         {
-            if (!(this->_has_same_dims(other.dims_.data())))
-                throw library_dimension_error(WLL_CURRENT_FUNCTION + "\ntensors have different dimensions.");
-            if (other.access_ == memory_type::proxy  ||
-                other.access_ == memory_type::shared ||
-                this->access_ == memory_type::proxy  ||
-                this->access_ == memory_type::shared)
-            {
-                _data_copy_n(other.ptr_, size_, ptr_);
-            }
-            else
-            {
-                this->_swap_pointers(std::move(other));
-            }
+            const auto [chunk_first, chunk_last] = _static_block(num_chunks, this->size(), i);
+            slots_[i].range_.store(_pack(chunk_first, chunk_last), std::memory_order_relaxed);
         }
-        return *this;
-    }
-
-    template<typename U>
-    tensor& operator=(const tensor<U, _rank>& other)
-    {
-        if(this == &other) return *this;
-        WLL_ASSERT(other.access_ != memory_type::empty); // other is empty
-        WLL_ASSERT(this->access_ != memory_type::empty); // *this is empty
-        // tensors with difference value_type should not have the same ptr_
-        WLL_ASSERT((void*)(this->ptr_) != (void*)(other.ptr_));
-        _data_copy_n(other.ptr_, size_, ptr_);
-        return *this;
-    }
+        remaining_.store(num_chunks);
+        failed_.store(false);
+        skipped_.store(false);
+        error_ = nullptr;
+        open_.store(true);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            generation_.fetch_add(1);
+        }
+        cv_.notify_all();
 
-    template<typename U>
-    tensor& operator=(tensor<U, _rank>&& other)
-    {
-        WLL_ASSERT(other.access_ != memory_type::empty); // other is empty
-        WLL_ASSERT(this->access_ != memory_type::empty); // *this is empty
-        // tensors with difference value_type should not have the same ptr_
-        WLL_ASSERT((void*)(this->ptr_) != (void*)(other.ptr_));
-        _data_copy_n(other.ptr_, size_, ptr_);
-        return *this;
-    }
+        _in_parallel_region = true;
+        this->_run(0);
+        _in_parallel_region = false;
+        while (remaining_.load() != 0)
+        {
+            global_abort.check(); // keep polling for the workers
+            std::this_thread::yield();
+        }
+        // workers check open_ after announcing themselves in active_, see _worker_loop
+        open_.store(false);
+        while (active_.load() != 0)
+            std::this_thread::yield();
 
-    [[nodiscard]] tensor clone(memory_type access = memory_type::owned) const
-    {
-        WLL_ASSERT(this->access_ != memory_type::empty); // cannot clone an empty tensor
-        WLL_ASSERT(access == memory_type::owned || access == memory_type::manual);
-        tensor ret(this->dims_, access);
-        _data_copy_n(ptr_, size_, ret.ptr_);
-        return ret;
+        if (error_)
+            std::rethrow_exception(error_);
+        if (skipped_.load())
+            throw library_abort_error(WLL_CURRENT_FUNCTION + "\ncomputation aborted.");
     }
 
-    ~tensor()
+    // the number of chunks parallel_for cuts [0, count) into
+    [[nodiscard]] size_t _num_chunks(size_t count, size_t& grain) const noexcept
     {
-        this->_destroy();
+        if (count == 0)
+            return 0;
+        if (grain == 0)
+            grain = (count - 1) / (_chunks_per_thread * this->size()) + 1;
+        grain = std::max(grain, (count - 1) / _max_chunks + 1);
+        return (count - 1) / grain + 1;
     }
 
-    [[nodiscard]] constexpr size_t rank() const noexcept
+    // chunks [first, last) that participant i of num_threads starts with
+    static std::pair<size_t, size_t> _static_block(size_t num_chunks, size_t num_threads, size_t i) noexcept
     {
-        return _rank;
+        return {num_chunks * i / num_threads, num_chunks * (i + 1) / num_threads};
     }
 
-    [[nodiscard]] size_t size() const noexcept
-    {
-        return size_;
-    }
+private:
+    static constexpr size_t _max_chunks = 0xFFFFFFFFu;
 
-    [[nodiscard]] _dims_t dimensions() const noexcept
+    struct alignas(64) _slot
     {
-        return dims_;
-    }
+        std::atomic<uint64_t> range_{0}; // chunks [first, last) packed as first << 32 | last
+    };
 
-    [[nodiscard]] size_t dimension(size_t level) const noexcept
+    struct _job
     {
-        return dims_[level];
-    }
+        void (*invoke_)(void*, size_t, size_t) = nullptr;
+        void*  fn_    = nullptr;
+        size_t first_ = 0;
+        size_t last_  = 0;
+        size_t grain_ = 1;
+    };
 
-    _ptr_t data() noexcept
+    template<typename Fn>
+    static void _invoke_chunk(void* fn, size_t first, size_t last)
     {
-        return this->ptr_;
+        (*reinterpret_cast<Fn*>(fn))(first, last);
     }
 
-    [[nodiscard]] _const_ptr_t data() const noexcept
+    static uint64_t _pack(size_t first, size_t last) noexcept
     {
-        return this->ptr_;
+        return (uint64_t(first) << 32) | uint64_t(last);
     }
 
-    bool operator==(const tensor& other) const
+    static size_t _first(uint64_t range) noexcept
     {
-        if (this->dims_ != other.dims_)
-            return false;
-        if (this->ptr_ == other.ptr_)
-            return true;
-        return std::equal(this->cbegin(), this->cend(), other.cbegin());
+        return size_t(range >> 32);
     }
 
-    template<typename... Idx>
-    value_type at(Idx... idx) const
+    static size_t _last(uint64_t range) noexcept
     {
-        static_assert(sizeof...(idx) == _rank);
-        return (*this)[_get_flat_idx(std::make_tuple(idx...))];
+        return size_t(range & 0xFFFFFFFFu);
     }
 
-    template<typename... Idx>
-    value_type& at(Idx... idx)
+    bool _pop(size_t index, size_t& chunk) noexcept
     {
-        static_assert(sizeof...(idx) == _rank);
-        return (*this)[_get_flat_idx(std::make_tuple(idx...))];
+        auto& range = slots_[index].range_;
+        uint64_t value = range.load();
+        while (_first(value) < _last(value))
+        {
+            if (range.compare_exchange_weak(value, _pack(_first(value) + 1, _last(value))))
+            {
+                chunk = _first(value);
+                return true;
+            }
+        }
+        return false;
     }
 
-    template<typename... Idx>
-    value_type operator()(Idx... idx) const
+    bool _steal(size_t index, size_t& chunk) noexcept
     {
-        static_assert(sizeof...(idx) == _rank);
-        return (*this)[_get_flat_idx_unsafe(std::make_tuple(idx...))];
+        for (size_t offset = 1; offset < this->size(); ++offset)
+        {
+            auto& range = slots_[(index + offset) % this->size()].range_;
+            uint64_t value = range.load();
+            while (_first(value) < _last(value))
+            {
+                // take the upper half, the victim keeps working from the front of its block
+                const size_t split = _last(value) - (_last(value) - _first(value) + 1) / 2;
+                if (range.compare_exchange_weak(value, _pack(_first(value), split)))
+                {
+                    chunk = split;
+                    slots_[index].range_.store(_pack(split + 1, _last(value)));
+                    return true;
+                }
+            }
+        }
+        return false;
     }
 
-    template<typename... Idx>
-    value_type& operator()(Idx... idx)
+    void _run(size_t index) noexcept
     {
-        static_assert(sizeof...(idx) == _rank);
-        return (*this)[_get_flat_idx_unsafe(std::make_tuple(idx...))];
+        size_t chunk = 0;
+        while (this->_pop(index, chunk) || this->_steal(index, chunk))
+        {
+            // after a failure chunks are skipped and the exception of fn is rethrown
+            bool run = !failed_.load(std::memory_order_relaxed);
+            if (run && global_abort.check())
+            {
+                run = false;
+                skipped_.store(true, std::memory_order_relaxed);
+            }
+            if (run)
+            {
+                const size_t first = job_.first_ + chunk * job_.grain_;
+                const size_t last  = std::min(first + job_.grain_, job_.last_);
+                try
+                {
+                    job_.invoke_(job_.fn_, first, last);
+                }
+                catch (...)
+                {
+                    bool expected = false;
+                    if (failed_.compare_exchange_strong(expected, true))
+                        error_ = std::current_exception();
+                }
+            }
+            remaining_.fetch_sub(1);
+        }
     }
 
-    template<typename IdxTuple>
-    value_type& _tuple_at(const IdxTuple& idx_tuple)
+    void _worker_loop(size_t index)
     {
-        static_assert(std::tuple_size_v<IdxTuple> == _rank);
-        return this->_tuple_at_impl(idx_tuple, std::make_index_sequence<_rank>{});
+        _in_parallel_region = true;
+        size_t seen = 0;
+        while (true)
+        {
+            // poll for a while first, so that back-to-back short loops do not wait for a wake-up
+            for (size_t i = 0; i < _spin_count && generation_.load() == seen && !stop_.load(); ++i)
+                std::this_thread::yield();
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [&] { return stop_.load() || generation_.load() != seen; });
+                if (stop_.load())
+                    return;
+                seen = generation_.load();
+            }
+            active_.fetch_add(1);
+            if (open_.load())
+                this->_run(index);
+            active_.fetch_sub(1);
+        }
     }
 
-    template<typename IdxTuple>
-    value_type _tuple_at(const IdxTuple& idx_tuple) const
+    void _stop() noexcept
     {
-        static_assert(std::tuple_size_v<IdxTuple> == _rank);
-        return this->_tuple_at_impl(idx_tuple, std::make_index_sequence<_rank>{});
-    }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_.store(true);
+        }
+        cv_.notify_all();
+        for (auto& worker : workers_)
+            if (worker.joinable())
+                worker.join();
+        workers_.clear();
+    }
+
+    static inline thread_local bool _in_parallel_region = false;
+
+    std::vector<std::thread>   workers_{};
+    std::unique_ptr<_slot[]>   slots_{};
+    _job                       job_{};
+    std::mutex                 submit_mutex_{};
+    std::mutex                 mutex_{};
+    std::condition_variable    cv_{};
+    std::atomic<size_t>        generation_{0};
+    std::atomic<size_t>        remaining_{0};
+    std::atomic<size_t>        active_{0};
+    std::atomic<bool>          open_{false};
+    std::atomic<bool>          failed_{false};
+    std::atomic<bool>          skipped_{false};
+    std::atomic<bool>          stop_{false};
+    std::exception_ptr         error_{};
+};
 
-    value_type operator[](size_t idx) const
-    {
-        WLL_ASSERT(idx < size_); // index out of range
-        return ptr_[idx];
-    }
+// created on first use with global_parallel_policy, destroyed by WolframLibrary_uninitialize
+inline std::unique_ptr<thread_pool> global_thread_pool;
 
-    value_type& operator[](size_t idx)
-    {
-        WLL_ASSERT(idx < size_); // index out of range
-        return ptr_[idx];
-    }
+inline thread_pool& get_thread_pool()
+{
+    if (!global_thread_pool)
+        global_thread_pool = std::make_unique<thread_pool>(global_parallel_policy.num_threads);
+    return *global_thread_pool;
+}
 
-    [[nodiscard]] _const_ptr_t cbegin() const noexcept
-    {
-        WLL_ASSERT(ptr_ != nullptr);
-        return ptr_;
-    }
+// call fn(chunk_first, chunk_last) for chunks of grain indices covering [first, last)
+// on the threads of the pool; grain == 0 picks a few chunks per thread. an abort throws
+// library_abort_error only if it made the loop skip work, and so only from the helpers built
+// on parallel_for (bulk copies and conversions, first-touch allocation, sorts, reductions,
+// scatter and the sparse kernels) while they still have chunks to run
+template<typename Fn>
+void parallel_for(size_t first, size_t last, Fn&& fn, size_t grain = 0)
+{
+    get_thread_pool().parallel_for(first, last, std::forward<Fn>(fn), grain);
+}
 
-    [[nodiscard]] _const_ptr_t cend() const noexcept
-    {
-        return this->cbegin() + size_;
-    }
+// parallel_for over the rows, i.e. the first dimension, of a tensor, matrix or sparse_array
+template<typename Array, typename Fn>
+void parallel_for_rows(const Array& array, Fn&& fn, size_t grain = 0)
+{
+    parallel_for(0, array.dimension(0), std::forward<Fn>(fn), grain);
+}
 
-    [[nodiscard]] _const_ptr_t begin() const noexcept
-    {
-        return this->cbegin();
-    }
 
-    [[nodiscard]] _const_ptr_t end() const noexcept
+template<typename LinkType, typename UserType>
+struct is_same_layout :
+    std::false_type {};
+template<typename UserType>
+struct is_same_layout<mint, UserType> :
+    std::bool_constant<std::is_integral_v<UserType> && sizeof(mint) == sizeof(UserType)> {};
+template<>
+struct is_same_layout<mreal, double> :
+    std::true_type {};
+template<>
+struct is_same_layout<mcomplex, std::complex<double>> :
+    std::true_type {};
+template<typename LinkType, typename UserType>
+constexpr bool is_same_layout_v = is_same_layout<LinkType, UserType>::value;
+
+template<typename Complex>
+struct is_std_complex :
+    std::false_type {};
+template<typename T>
+struct is_std_complex<std::complex<T>> :
+    std::true_type {};
+template<typename Complex>
+constexpr bool is_std_complex_v = is_std_complex<Complex>::value;
+
+template<typename Complex>
+struct complex_value
+{
+    using type = void;
+};
+template<typename T>
+struct complex_value<std::complex<T>>
+{
+    using type = T;
+};
+template<typename Complex>
+using complex_value_t = typename complex_value<Complex>::type;
+
+// component type of complex-like types, both std::complex<T> and mcomplex
+template<typename Complex>
+struct _complex_component
+{
+    using type = complex_value_t<Complex>;
+};
+template<>
+struct _complex_component<mcomplex>
+{
+    using type = mreal;
+};
+template<typename Complex>
+using _complex_component_t = typename _complex_component<Complex>::type;
+
+template<typename>
+constexpr bool _always_false_v = false;
+
+
+template<size_t Size>
+size_t _flattened_size(const std::array<size_t, Size>& dims) noexcept
+{
+    size_t size = 1;
+    for (size_t d : dims) size *= d;
+    return size;
+}
+
+inline size_t _flattened_size(const std::vector<size_t>& dims) noexcept
+{
+    size_t size = 1;
+    for (size_t d : dims) size *= d;
+    return size;
+}
+
+template<size_t Rank, typename T>
+std::array<size_t, Rank> _convert_to_dims_array(std::initializer_list<T> dims)
+{
+    static_assert(std::is_integral_v<T>, "dimensions should be of integral types");
+    WLL_ASSERT(dims.size() == Rank);   // dims should have size equal to the rank
+    std::array<size_t, Rank> dims_array;
+    std::copy_n(dims.begin(), Rank, dims_array.begin());
+    return dims_array;
+}
+
+template<typename X, typename Y>
+constexpr auto _add_if_negative(X val_x, Y val_y)
+{
+    if constexpr (std::is_signed_v<X>)
+        if (val_x < X(0))
+            return Y(val_x) + val_y;
+    return Y(val_x);
+}
+
+
+template<typename Target>
+struct _mtype_cast_impl
+{
+    template<typename Value>
+    constexpr Target operator()(const Value& value) noexcept
+    {
+        return static_cast<Target>(value);
+    }
+
+    constexpr Target operator()(const mcomplex& value)
+    {
+        throw library_type_error(WLL_CURRENT_FUNCTION + "\ncannot convert from mcomplex");
+        return Target{};
+    }
+
+    template<typename T>
+    constexpr Target operator()(const std::complex<T>& value)
+    {
+        throw library_type_error(WLL_CURRENT_FUNCTION + "\ncannot convert from std::complex<T>");
+        return Target{};
+    }
+};
+template<typename T>
+struct _mtype_cast_impl<std::complex<T>>
+{
+    template<typename Value>
+    constexpr std::complex<T> operator()(const Value& value) noexcept
+    {
+        return std::complex<T>(static_cast<T>(value));
+    }
+
+    constexpr std::complex<T> operator()(const mcomplex& value) noexcept
+    {
+        return std::complex<T>(static_cast<T>(mcreal(value)),
+                               static_cast<T>(mcimag(value)));
+    }
+
+    template<typename U>
+    constexpr std::complex<T> operator()(const std::complex<U>& value) noexcept
+    {
+        return std::complex<T>(static_cast<T>(value.real()),
+                               static_cast<T>(value.imag()));
+    }
+};
+template<>
+struct _mtype_cast_impl<mcomplex>
+{
+    template<typename Value>
+    constexpr mcomplex operator()(const Value& value) noexcept
+    {
+        mcomplex ret;
+        mcreal(ret) = static_cast<mreal>(value);
+        mcimag(ret) = mreal{};
+        return ret;
+    }
+
+    constexpr mcomplex operator()(const mcomplex& value) noexcept
+    {
+        return value;
+    }
+
+    template<typename T>
+    constexpr mcomplex operator()(const std::complex<T>& value) noexcept
+    {
+        mcomplex ret;
+        mcreal(ret) = static_cast<mreal>(value.real());
+        mcimag(ret) = static_cast<mreal>(value.imag());
+        return ret;
+    }
+};
+
+template<typename Target, typename Value>
+constexpr Target _mtype_cast(const Value& value)
+{
+    return _mtype_cast_impl<Target>()(value);
+}
+
+inline bool operator==(const mcomplex& a, const mcomplex& b)
+{
+    return (mcreal(a) == mcreal(b)) && (mcimag(a) == mcimag(b));
+}
+inline bool operator!=(const mcomplex& a, const mcomplex& b)
+{
+    return !(a == b);
+}
+
+template<typename SrcType, typename DestType>
+constexpr bool _is_bitwise_copyable_v =
+    std::is_same_v<SrcType, DestType> ||
+    is_same_layout_v<SrcType, DestType> || is_same_layout_v<DestType, SrcType>;
+
+// element-wise static_cast with no aliasing, a form that compilers vectorize
+template<typename SrcType, typename DestType>
+inline void _convert_n(const SrcType* WLL_RESTRICT src_ptr, size_t count,
+                       DestType* WLL_RESTRICT dest_ptr) noexcept
+{
+    for (size_t i = 0; i < count; ++i)
+        dest_ptr[i] = static_cast<DestType>(src_ptr[i]);
+}
+
+// memcpy with non-temporal stores, for copies larger than the cache that would only evict it
+inline void _streaming_copy(void* WLL_RESTRICT dest, const void* WLL_RESTRICT src, size_t bytes) noexcept
+{
+#if defined(WLL_HAS_STREAMING_STORE)
+    char*       dest_ptr = static_cast<char*>(dest);
+    const char* src_ptr  = static_cast<const char*>(src);
+    const size_t head = std::min(size_t((16 - (reinterpret_cast<uintptr_t>(dest_ptr) & 15)) & 15), bytes);
+    std::memcpy(dest_ptr, src_ptr, head);
+    dest_ptr += head;
+    src_ptr  += head;
+    bytes    -= head;
+    for (; bytes >= 64; bytes -= 64, dest_ptr += 64, src_ptr += 64)
+    {
+        const __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src_ptr));
+        const __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src_ptr + 16));
+        const __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src_ptr + 32));
+        const __m128i v3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src_ptr + 48));
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dest_ptr), v0);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dest_ptr + 16), v1);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dest_ptr + 32), v2);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dest_ptr + 48), v3);
+    }
+    std::memcpy(dest_ptr, src_ptr, bytes);
+    _mm_sfence(); // streaming stores are weakly ordered
+#else
+    std::memcpy(dest, src, bytes);
+#endif
+}
+
+template<bool Streaming, typename SrcType, typename DestType>
+inline void _data_copy_n_impl(const SrcType* src_ptr, size_t count, DestType* dest_ptr)
+{
+    if (count > 0)
+    {
+        WLL_ASSERT(src_ptr != nullptr && dest_ptr != nullptr);
+        WLL_ASSERT((void*)src_ptr != (void*)dest_ptr); // cannot copy to itself
+        using src_comp_t  = _complex_component_t<SrcType>;
+        using dest_comp_t = _complex_component_t<DestType>;
+        if constexpr (_is_bitwise_copyable_v<SrcType, DestType>)
+        {
+            if constexpr (Streaming)
+                _streaming_copy(dest_ptr, src_ptr, count * sizeof(DestType));
+            else
+                std::memcpy(static_cast<void*>(dest_ptr), static_cast<const void*>(src_ptr),
+                            count * sizeof(DestType));
+        }
+        else if constexpr (std::is_arithmetic_v<SrcType> && std::is_arithmetic_v<DestType>)
+        {
+            _convert_n(src_ptr, count, dest_ptr);
+        }
+        else if constexpr (!std::is_void_v<src_comp_t> && !std::is_void_v<dest_comp_t>)
+        {
+            // complex to complex, convert real and imaginary parts as a flat array
+            static_assert(sizeof(SrcType) == 2 * sizeof(src_comp_t));
+            static_assert(sizeof(DestType) == 2 * sizeof(dest_comp_t));
+            _convert_n(reinterpret_cast<const src_comp_t*>(src_ptr), 2 * count,
+                       reinterpret_cast<dest_comp_t*>(dest_ptr));
+        }
+        else
+        {
+            for (size_t i = 0; i < count; ++i)
+                dest_ptr[i] = _mtype_cast<DestType>(src_ptr[i]);
+        }
+    }
+}
+
+template<typename SrcType, typename DestType>
+inline void _data_copy_n(const SrcType* src_ptr, size_t count, DestType* dest_ptr)
+{
+    if (count * sizeof(DestType) < global_parallel_policy.bulk_copy_threshold)
+    {
+        _data_copy_n_impl<false>(src_ptr, count, dest_ptr);
+        return;
+    }
+    // chunks follow the default partition of parallel_for, so the threads that write
+    // a part of the destination are the ones that later loops over it run on
+    parallel_for(0, count, [=](size_t first, size_t last)
+    {
+        _data_copy_n_impl<true>(src_ptr + first, last - first, dest_ptr + first);
+    });
+}
+
+template<size_t Rank>
+struct _index_array
+{
+    using _idx_t = std::array<size_t, Rank>;
+
+    explicit _index_array(const _idx_t& idx) noexcept : idx_{idx} {}
+
+    template<typename Value>
+    std::pair<_idx_t, Value> operator=(const Value& value) const noexcept
+    {
+        return {idx_, value};
+    }
+
+    _idx_t idx_;
+};
+
+template<typename... Indices>
+_index_array<sizeof...(Indices)> pos(const Indices&... indices)
+{
+    return std::array<size_t, sizeof...(Indices)>({size_t(indices)...});
+}
+
+
+#define MType_Void -1
+
+template<typename T>
+struct derive_tensor_data_type
+{
+    using strict_type =
+        std::conditional_t<is_same_layout_v<mint, T>, mint,
+        std::conditional_t<is_same_layout_v<mreal, T>, mreal,
+        std::conditional_t<is_same_layout_v<mcomplex, T>, mcomplex, void>>>;
+    using convert_type =
+        std::conditional_t<std::is_integral_v<T>, mint,
+        std::conditional_t<std::is_floating_point_v<T>, mreal,
+        std::conditional_t<is_std_complex_v<T>, mcomplex, void>>>;
+    static constexpr int strict_type_v =
+        std::is_same_v<strict_type, mint> ? MType_Integer :
+        std::is_same_v<strict_type, mreal> ? MType_Real :
+        std::is_same_v<strict_type, mcomplex> ? MType_Complex : MType_Void;
+    static constexpr int convert_type_v =
+        std::is_same_v<convert_type, mint> ? MType_Integer :
+        std::is_same_v<convert_type, mreal> ? MType_Real :
+        std::is_same_v<convert_type, mcomplex> ? MType_Complex : MType_Void;
+};
+
+enum memory_type
+{
+    // who has resource    memory managed by
+    empty,  // -                   -
+    owned,  // wll::tensor         _owned_malloc/_owned_free
+    proxy,  // kernel              -
+    manual, // wll::tensor         MTensor_new/MTensor_free
+    shared, // kernel/wll::tensor  MTensor_disown
+    scratch, // wll::tensor        global_scratch, invalid after the call returns
+    result  // wll::tensor         the default; manual if value_type matches an MType and on the
+            //                     kernel thread, so that returning the tensor does not copy,
+            //                     owned otherwise
+};
+
+// data of an MTensor of type MType_Integer, MType_Real or MType_Complex
+inline void* _get_mtensor_data(MTensor mtensor, int mtype)
+{
+    WLL_ASSERT(mtype == MType_Integer || mtype == MType_Real || mtype == MType_Complex);
+    if (mtype == MType_Integer)
+        return reinterpret_cast<void*>(global_lib_data->MTensor_getIntegerData(mtensor));
+    else if (mtype == MType_Real)
+        return reinterpret_cast<void*>(global_lib_data->MTensor_getRealData(mtensor));
+    else // mtype == MType_Complex
+        return reinterpret_cast<void*>(global_lib_data->MTensor_getComplexData(mtensor));
+}
+
+// copy (and convert) count elements of MTensor data of type mtype
+template<typename T>
+void _copy_from_mtensor_data(const void* src_ptr, int mtype, size_t count, T* dest_ptr)
+{
+    if (mtype == MType_Integer)
+        _data_copy_n(reinterpret_cast<const mint*>(src_ptr), count, dest_ptr);
+    else if (mtype == MType_Real)
+        _data_copy_n(reinterpret_cast<const mreal*>(src_ptr), count, dest_ptr);
+    else // mtype == MType_Complex
+        _data_copy_n(reinterpret_cast<const mcomplex*>(src_ptr), count, dest_ptr);
+}
+
+// new MTensor holding T, of the strictly matched MType or of the MType T converts to
+template<typename T, bool Strict>
+MTensor _new_mtensor(size_t rank, const size_t* dims)
+{
+    constexpr int mtype = Strict ? derive_tensor_data_type<T>::strict_type_v :
+                                   derive_tensor_data_type<T>::convert_type_v;
+    if (mtype == MType_Void)
+        throw library_type_error(WLL_CURRENT_FUNCTION + "\nvalue_type cannot be matched to any MType.");
+    MTensor mtensor = nullptr;
+    int err = global_lib_data->MTensor_new(
+        mtype, mint(rank), reinterpret_cast<mint*>(const_cast<size_t*>(dims)), &mtensor);
+    if (err != LIBRARY_NO_ERROR)
+        throw library_error(err, WLL_CURRENT_FUNCTION + "\nMTensor_new() failed.");
+    return mtensor;
+}
+
+// copy of count elements as a new MTensor of the MType T converts to
+template<typename T>
+MTensor _make_mtensor_copy(const T* src_ptr, size_t count, size_t rank, const size_t* dims)
+{
+    using mtype = typename derive_tensor_data_type<T>::convert_type;
+    static_assert(!std::is_same_v<void, mtype>, "invalid data type to convert to MType");
+    MTensor mtensor = _new_mtensor<T, false>(rank, dims);
+    try
+    {
+        _data_copy_n(src_ptr, count, reinterpret_cast<mtype*>(
+            _get_mtensor_data(mtensor, derive_tensor_data_type<T>::convert_type_v)));
+    }
+    catch (...)
+    {
+        // large copies run in parallel, which throws when the kernel aborts
+        global_lib_data->MTensor_free(mtensor);
+        throw;
+    }
+    return mtensor;
+}
+
+// true on the thread the kernel called into the library on, outside parallel regions;
+// MTensor_new and MTensor_free are not thread-safe and may only be called there
+inline bool _on_kernel_thread() noexcept
+{
+    return global_lib_data != nullptr && !thread_pool::in_parallel_region() &&
+           global_abort.is_caller_thread();
+}
+
+template<typename T>
+memory_type _resolve_tensor_access(memory_type access, size_t size) noexcept
+{
+    // tensors that can be handed to the kernel are allocated by the kernel, so that returning
+    // them does not copy; tensors created on worker threads, and large blocks whose pages are
+    // to be interleaved over NUMA nodes, stay owned
+    constexpr int mtype = derive_tensor_data_type<T>::strict_type_v;
+    if (access != memory_type::result)
+        return access;
+    const auto& policy = global_allocation_policy;
+    if (policy.numa_interleave && size * sizeof(T) >= policy.first_touch_threshold)
+        return memory_type::owned;
+    return (mtype != MType_Void && _on_kernel_thread()) ? memory_type::manual : memory_type::owned;
+}
+
+// data of size elements for a tensor of the given access, mtensor is set for manual tensors
+template<typename T>
+T* _allocate_tensor_data(memory_type access, size_t rank, const size_t* dims, size_t size,
+                         bool zero_fill, MTensor& mtensor)
+{
+    WLL_ASSERT(access == memory_type::owned ||
+               access == memory_type::manual ||
+               access == memory_type::scratch);
+    T* ptr = nullptr;
+    if (access == memory_type::owned)
+    {
+        // large blocks are first touched by the threads that later loops over them run on,
+        // which places their pages on those threads' NUMA nodes; uninitialized blocks are
+        // left to the first loop or bulk copy that writes them
+        const bool first_touch = zero_fill &&
+            size * sizeof(T) >= global_allocation_policy.first_touch_threshold;
+        ptr = reinterpret_cast<T*>(_owned_malloc(size * sizeof(T), zero_fill && !first_touch));
+        if (ptr == nullptr)
+            throw library_memory_error(WLL_CURRENT_FUNCTION + "\nmemory allocation failed, access_ == owned.");
+        if (first_touch)
+        {
+            // parallel_for throws when the kernel aborts part way through
+            try
+            {
+                parallel_for(0, size, [=](size_t first, size_t last)
+                {
+                    std::memset(static_cast<void*>(ptr + first), 0, (last - first) * sizeof(T));
+                });
+            }
+            catch (...)
+            {
+                _owned_free(ptr);
+                throw;
+            }
+        }
+    }
+    else if (access == memory_type::scratch)
+    {
+        ptr = reinterpret_cast<T*>(global_scratch.allocate(size * sizeof(T), zero_fill));
+    }
+    else // access == memory_type::manual
+    {
+        WLL_ASSERT(_on_kernel_thread()); // kernel memory from a worker thread
+        mtensor = _new_mtensor<T, true>(rank, dims);
+        ptr = reinterpret_cast<T*>(
+            _get_mtensor_data(mtensor, derive_tensor_data_type<T>::strict_type_v));
+    }
+    return ptr;
+}
+
+template<typename T>
+void _free_tensor_data(memory_type access, T* ptr, MTensor mtensor) noexcept
+{
+    if (access == memory_type::empty)
+    {
+        WLL_ASSERT(mtensor == nullptr);
+        WLL_ASSERT(ptr == nullptr);
+    }
+    else if (access == memory_type::owned)
+    {
+        WLL_ASSERT(mtensor == nullptr);
+        _owned_free(ptr);
+    }
+    else if (access == memory_type::proxy || access == memory_type::scratch)
+    {
+        // do nothing
+    }
+    else if (access == memory_type::manual)
+    {
+        global_lib_data->MTensor_free(mtensor);
+    }
+    else if (access == memory_type::shared)
+    {
+        global_lib_data->MTensor_disown(mtensor);
+    }
+}
+
+
+template<typename T, size_t Rank>
+struct tensor_init_data
+{
+    using type = std::initializer_list<typename tensor_init_data<T, Rank - 1>::type>;
+};
+template<typename T>
+struct tensor_init_data<T, 0>
+{
+    using type = T;
+};
+template<typename T, size_t Rank>
+using tensor_init_data_t = typename tensor_init_data<T, Rank>::type;
+
+
+// 0-based inclusive range with step, negative indices count from the end,
+// e.g. span(1, -2) selects all but the first and the last element
+struct span
+{
+    constexpr span() noexcept = default;
+    constexpr span(ptrdiff_t first, ptrdiff_t last, ptrdiff_t step = 1) noexcept :
+        first_{first}, last_{last}, step_{step} {}
+
+    ptrdiff_t first_ = 0;
+    ptrdiff_t last_  = -1;
+    ptrdiff_t step_  = 1;
+};
+
+constexpr span all{};
+
+template<typename... Indices>
+constexpr size_t _count_spans_v = (size_t(std::is_same_v<Indices, span>) + ... + size_t(0));
+
+template<size_t Rank, typename... Indices>
+constexpr size_t _sliced_rank_v = _count_spans_v<Indices...> + (Rank - sizeof...(Indices));
+
+template<typename Stride = ptrdiff_t, size_t Rank>
+constexpr std::array<Stride, Rank> _row_major_strides(const std::array<size_t, Rank>& dims) noexcept
+{
+    std::array<Stride, Rank> strides{};
+    Stride stride = 1;
+    for (size_t i = Rank; i > 0; --i)
+    {
+        strides[i - 1] = stride;
+        stride *= Stride(dims[i - 1]);
+    }
+    return strides;
+}
+
+template<size_t Level, size_t Rank, typename Fn, typename... Idx>
+void _for_each_index_impl(const std::array<size_t, Rank>& first, const std::array<size_t, Rank>& last,
+                          Fn& fn, Idx... idx)
+{
+    if constexpr (Level == Rank)
+        fn(idx...);
+    else
+        for (size_t i = first[Level]; i < last[Level]; ++i)
+            _for_each_index_impl<Level + 1>(first, last, fn, idx..., i);
+}
+
+// call fn(i0, i1, ...) for every multi-index in [first, last) in row-major order
+template<size_t Rank, typename Fn>
+void for_each_index(const std::array<size_t, Rank>& first, const std::array<size_t, Rank>& last, Fn fn)
+{
+    for (size_t i = 0; i < Rank; ++i)
+        if (first[i] >= last[i])
+            return;
+    _for_each_index_impl<0>(first, last, fn);
+}
+
+template<size_t Rank, typename Fn>
+void for_each_index(const std::array<size_t, Rank>& dims, Fn fn)
+{
+    for_each_index(std::array<size_t, Rank>{}, dims, fn);
+}
+
+template<size_t Level = 0, size_t NewLevel = 0, size_t Rank, size_t NewRank,
+         typename Ptr, typename Index, typename... Rest>
+void _make_slice(const std::array<size_t, Rank>& dims, const std::array<ptrdiff_t, Rank>& strides,
+                 Ptr& ptr, std::array<size_t, NewRank>& new_dims,
+                 std::array<ptrdiff_t, NewRank>& new_strides, Index index, Rest... rest)
+{
+    static_assert(Level < Rank, "too many indices");
+    const ptrdiff_t dim = ptrdiff_t(dims[Level]);
+    if constexpr (std::is_same_v<Index, span>)
+    {
+        if (index.step_ == 0)
+            throw library_dimension_error(WLL_CURRENT_FUNCTION + "\nspan step cannot be zero");
+        const ptrdiff_t first = _add_if_negative(index.first_, dim);
+        const ptrdiff_t last  = _add_if_negative(index.last_, dim);
+        const ptrdiff_t diff  = (index.step_ > 0) ? (last - first) : (first - last);
+        const ptrdiff_t step  = (index.step_ > 0) ? index.step_ : -index.step_;
+        const size_t    count = (diff < 0) ? 0 : size_t(diff / step + 1);
+        if (count > 0 && !(0 <= first && first < dim && 0 <= last && last < dim))
+            throw std::out_of_range(WLL_CURRENT_FUNCTION + "\nspan out of range");
+        if (count > 0)
+            ptr += first * strides[Level];
+        new_dims[NewLevel]    = count;
+        new_strides[NewLevel] = strides[Level] * index.step_;
+        if constexpr (sizeof...(Rest) > 0)
+            _make_slice<Level + 1, NewLevel + 1>(dims, strides, ptr, new_dims, new_strides, rest...);
+        else
+            for (size_t i = 1; i < Rank - Level; ++i)
+            {
+                new_dims[NewLevel + i]    = dims[Level + i];
+                new_strides[NewLevel + i] = strides[Level + i];
+            }
+    }
+    else
+    {
+        static_assert(std::is_integral_v<Index>, "index must be of an integral type or wll::span");
+        const ptrdiff_t idx = _add_if_negative(index, dim);
+        if (!(0 <= idx && idx < dim))
+            throw std::out_of_range(WLL_CURRENT_FUNCTION + "\nindex out of range");
+        ptr += idx * strides[Level];
+        if constexpr (sizeof...(Rest) > 0)
+            _make_slice<Level + 1, NewLevel>(dims, strides, ptr, new_dims, new_strides, rest...);
+        else
+            for (size_t i = 1; i < Rank - Level; ++i)
+            {
+                new_dims[NewLevel + i - 1]    = dims[Level + i];
+                new_strides[NewLevel + i - 1] = strides[Level + i];
+            }
+    }
+}
+
+
+template<typename T, size_t Rank>
+class tensor;
+
+// non-owning strided view of tensor data, never copies unless materialized
+template<typename T, size_t Rank>
+class tensor_view
+{
+public:
+    using value_type   = std::remove_const_t<T>;
+    static constexpr size_t _rank = Rank;
+    using _ptr_t       = T*;
+    using _dims_t      = std::array<size_t, _rank>;
+    using _strides_t   = std::array<ptrdiff_t, _rank>;
+    static_assert(_rank > 0);
+
+    template<typename U, size_t URank>
+    friend class tensor_view;
+
+    tensor_view() noexcept = default;
+
+    tensor_view(_ptr_t ptr, _dims_t dims, _strides_t strides) noexcept :
+        ptr_{ptr}, dims_{dims}, strides_{strides}, size_{_flattened_size(dims)} {}
+
+    tensor_view(_ptr_t ptr, _dims_t dims) noexcept :
+        tensor_view(ptr, dims, _row_major_strides(dims)) {}
+
+    template<typename U, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+    tensor_view(const tensor_view<U, _rank>& other) noexcept :
+        ptr_{other.ptr_}, dims_{other.dims_}, strides_{other.strides_}, size_{other.size_} {}
+
+    [[nodiscard]] constexpr size_t rank() const noexcept
+    {
+        return _rank;
+    }
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    [[nodiscard]] _dims_t dimensions() const noexcept
+    {
+        return dims_;
+    }
+
+    [[nodiscard]] size_t dimension(size_t level) const noexcept
+    {
+        return dims_[level];
+    }
+
+    [[nodiscard]] _strides_t strides() const noexcept
+    {
+        return strides_;
+    }
+
+    [[nodiscard]] ptrdiff_t stride(size_t level) const noexcept
+    {
+        return strides_[level];
+    }
+
+    [[nodiscard]] _ptr_t data() const noexcept
+    {
+        return ptr_;
+    }
+
+    [[nodiscard]] bool is_contiguous() const noexcept
+    {
+        return strides_ == _row_major_strides(dims_);
+    }
+
+    template<typename... Idx>
+    T& at(Idx... idx) const
+    {
+        static_assert(sizeof...(idx) == _rank);
+        return ptr_[_get_offset<true>(std::make_index_sequence<_rank>{}, idx...)];
+    }
+
+    template<typename... Idx>
+    T& operator()(Idx... idx) const
+    {
+        static_assert(sizeof...(idx) == _rank);
+        return ptr_[_get_offset<false>(std::make_index_sequence<_rank>{}, idx...)];
+    }
+
+    template<typename... Indices>
+    [[nodiscard]] auto view(Indices... indices) const
+    {
+        constexpr size_t new_rank = _sliced_rank_v<_rank, Indices...>;
+        static_assert(new_rank > 0, "use at() or operator() to access a single element");
+        if constexpr (sizeof...(Indices) == 0)
+            return *this;
+        else
+        {
+            std::array<size_t, new_rank>    new_dims;
+            std::array<ptrdiff_t, new_rank> new_strides;
+            _ptr_t ptr = ptr_;
+            _make_slice(dims_, strides_, ptr, new_dims, new_strides, indices...);
+            return tensor_view<T, new_rank>(ptr, new_dims, new_strides);
+        }
+    }
+
+    // apply fn to every element in row-major order
+    template<typename Fn>
+    void for_each(Fn fn) const
+    {
+        if (size_ > 0)
+            _for_each_impl<0>(ptr_, fn);
+    }
+
+    template<typename OutputPtr>
+    void copy_data_to(OutputPtr* dest) const
+    {
+        if (size_ > 0)
+            _copy_to_impl<0>(ptr_, dest);
+    }
+
+    template<typename InputPtr>
+    void copy_data_from(const InputPtr* src) const
+    {
+        static_assert(!std::is_const_v<T>, "cannot copy to a view of constant data");
+        if (size_ > 0)
+            _copy_from_impl<0>(ptr_, src);
+    }
+
+    [[nodiscard]] tensor<value_type, _rank> clone(memory_type access = memory_type::result) const
+    {
+        tensor<value_type, _rank> ret(this->dims_, uninitialized, access);
+        this->copy_data_to(ret.data());
+        return ret;
+    }
+
+    [[nodiscard]] MTensor get_mtensor() const
+    {
+        using mtype = typename derive_tensor_data_type<value_type>::convert_type;
+        static_assert(!std::is_same_v<void, mtype>, "invalid data type to convert to MType");
+        tensor<mtype, _rank> ret(this->dims_, uninitialized, memory_type::manual);
+        this->copy_data_to(ret.data());
+        return std::move(ret).get_mtensor();
+    }
+
+private:
+    template<bool Check, typename... Idx, size_t... Is>
+    ptrdiff_t _get_offset(std::index_sequence<Is...>, Idx... idx) const
+    {
+        ptrdiff_t offset = 0;
+        ((offset += _get_level_offset<Check, Is>(idx)), ...);
+        return offset;
+    }
+
+    template<bool Check, size_t Level, typename Idx>
+    ptrdiff_t _get_level_offset(Idx idx) const
+    {
+        static_assert(std::is_integral_v<Idx>, "index must be of an integral type");
+        const ptrdiff_t signed_idx = _add_if_negative(idx, ptrdiff_t(dims_[Level]));
+        if constexpr (Check)
+        {
+            if (!(0 <= signed_idx && size_t(signed_idx) < dims_[Level]))
+                throw std::out_of_range(WLL_CURRENT_FUNCTION + "\nindex out of range");
+        }
+        else
+            WLL_ASSERT(0 <= signed_idx && size_t(signed_idx) < dims_[Level]);
+        return signed_idx * strides_[Level];
+    }
+
+    template<size_t Level, typename Fn>
+    void _for_each_impl(_ptr_t ptr, Fn& fn) const
+    {
+        const size_t    dim    = dims_[Level];
+        const ptrdiff_t stride = strides_[Level];
+        for (size_t i = 0; i < dim; ++i, ptr += stride)
+        {
+            if constexpr (Level + 1 == _rank)
+                fn(*ptr);
+            else
+                _for_each_impl<Level + 1>(ptr, fn);
+        }
+    }
+
+    template<size_t Level, typename Dest>
+    void _copy_to_impl(_ptr_t ptr, Dest*& dest) const
+    {
+        const size_t    dim    = dims_[Level];
+        const ptrdiff_t stride = strides_[Level];
+        if constexpr (Level + 1 == _rank)
+        {
+            if (stride == 1)
+                _data_copy_n(static_cast<const value_type*>(ptr), dim, dest);
+            else
+                for (size_t i = 0; i < dim; ++i, ptr += stride)
+                    dest[i] = _mtype_cast<Dest>(*ptr);
+            dest += dim;
+        }
+        else
+        {
+            for (size_t i = 0; i < dim; ++i, ptr += stride)
+                _copy_to_impl<Level + 1>(ptr, dest);
+        }
+    }
+
+    template<size_t Level, typename Src>
+    void _copy_from_impl(_ptr_t ptr, const Src*& src) const
+    {
+        const size_t    dim    = dims_[Level];
+        const ptrdiff_t stride = strides_[Level];
+        if constexpr (Level + 1 == _rank)
+        {
+            if (stride == 1)
+                _data_copy_n(src, dim, ptr);
+            else
+                for (size_t i = 0; i < dim; ++i, ptr += stride)
+                    *ptr = _mtype_cast<value_type>(src[i]);
+            src += dim;
+        }
+        else
+        {
+            for (size_t i = 0; i < dim; ++i, ptr += stride)
+                _copy_from_impl<Level + 1>(ptr, src);
+        }
+    }
+
+private:
+    _ptr_t     ptr_ = nullptr;
+    _dims_t    dims_{};
+    _strides_t strides_{};
+    size_t     size_{};
+};
+
+template<typename T>
+struct is_tensor_view :
+    std::false_type {};
+template<typename T, size_t Rank>
+struct is_tensor_view<tensor_view<T, Rank>> :
+    std::true_type {};
+template<typename T>
+constexpr bool is_tensor_view_v = is_tensor_view<T>::value;
+
+struct _expr_base {};
+
+template<typename T>
+constexpr bool is_tensor_expr_v = std::is_base_of_v<_expr_base, T>;
+
+
+template<typename T, size_t Rank>
+class tensor
+{
+public:
+    using value_type   = T;
+    static constexpr size_t _rank = Rank;
+    using _ptr_t       = value_type*;
+    using _const_ptr_t = const value_type*;
+    using _dims_t      = std::array<size_t, _rank>;
+    using _strides_t   = std::array<size_t, _rank>;
+    using _init_dims_t = std::initializer_list<size_t>;
+    using _init_data_t = tensor_init_data_t<value_type, _rank>;
+    static_assert(_rank > 0);
+
+    template<typename U, size_t URank>
+    friend class tensor;
+
+    tensor() noexcept = default;
+
+    tensor(MTensor mtensor, memory_type access) :
+        mtensor_{mtensor}, access_{access}
+    {
+        auto mtensor_rank = global_lib_data->MTensor_getRank(mtensor);
+        WLL_ASSERT(_rank == mtensor_rank);
+        WLL_ASSERT(access_ == memory_type::owned ||
+                   access_ == memory_type::proxy ||
+                   access_ == memory_type::shared);
+
+        const mint* dims_ptr = global_lib_data->MTensor_getDimensions(mtensor);
+        std::copy_n(dims_ptr, _rank, dims_.begin());
+        strides_ = _row_major_strides<size_t>(dims_);
+        size_ = global_lib_data->MTensor_getFlattenedLength(mtensor);
+
+        int   mtype   = int(global_lib_data->MTensor_getType(mtensor));
+        void* src_ptr = _get_mtensor_data(mtensor, mtype);
+        bool  do_copy = (mtype != derive_tensor_data_type<value_type>::strict_type_v);
+
+        if (access_ == memory_type::owned)
+            do_copy = true; // do copy anyway
+
+        if (do_copy)
+        {
+            WLL_ASSERT(access_ == memory_type::owned ||
+                       access_ == memory_type::proxy);
+            mtensor_ = nullptr;
+            access_  = memory_type::owned; // *this will own data after copy
+            this->_allocate(false);
+            try
+            {
+                _copy_from_mtensor_data(src_ptr, mtype, size_, ptr_);
+            }
+            catch (...)
+            {
+                // the destructor does not run when a constructor throws
+                this->_destroy();
+                throw;
+            }
+        }
+        else // do_copy == false
+        {
+            WLL_ASSERT(access_ == memory_type::proxy ||
+                       access_ == memory_type::shared);
+            ptr_ = reinterpret_cast<_ptr_t>(src_ptr);
+        }
+    }
+
+    explicit tensor(_dims_t dims, memory_type access = memory_type::result) :
+        dims_{dims}, size_{_flattened_size(dims)}, access_{_resolve_access(access, size_)}
+    {
+        this->_allocate(true);
+    }
+
+    tensor(_init_dims_t dims, memory_type access = memory_type::result) :
+        tensor(_convert_to_dims_array<_rank>(dims), access) {}
+
+    tensor(_dims_t dims, uninitialized_t, memory_type access = memory_type::result) :
+        dims_{dims}, size_{_flattened_size(dims)}, access_{_resolve_access(access, size_)}
+    {
+        this->_allocate(false);
+    }
+
+    tensor(_init_dims_t dims, uninitialized_t, memory_type access = memory_type::result) :
+        tensor(_convert_to_dims_array<_rank>(dims), uninitialized, access) {}
+
+    tensor(_dims_t dims, const _init_data_t& data, memory_type access = memory_type::result) :
+        tensor(dims, access)
+    {
+        this->_fill_init_data(data);
+    }
+
+    tensor(_init_dims_t dims, const _init_data_t& data, memory_type access = memory_type::result) :
+        tensor(_get_init_dims(dims, data), data, access)
+    {
+        this->_fill_init_data(data);
+    }
+
+    template<typename Expr, typename = std::enable_if_t<is_tensor_expr_v<Expr>>>
+    tensor(const Expr& expr, memory_type access = memory_type::result) :
+        tensor(expr.dimensions(), uninitialized, access)
+    {
+        static_assert(Expr::_rank == _rank, "expression has a different rank");
+        _evaluate_expr(expr, ptr_, size_);
+    }
+
+    tensor(const tensor& other) :
+        tensor(other.dims_, uninitialized)
+    {
+        _data_copy_n(other.ptr_, size_, ptr_);
+    }
+
+    tensor(tensor&& other) noexcept :
+        dims_{other.dims_}, size_{other.size_}
+    {
+        std::swap(ptr_, other.ptr_);
+        std::swap(access_, other.access_);
+        std::swap(mtensor_, other.mtensor_);
+    }
+
+    template<typename U>
+    explicit tensor(const tensor<U, _rank>& other) :
+        tensor(other.dims_, uninitialized)
+    {
+        _data_copy_n(other.ptr_, size_, ptr_);
+    }
+
+    template<typename U>
+    explicit tensor(tensor<U, _rank>&& other) :
+        tensor(other.dims_, uninitialized)
+    {
+        _data_copy_n(other.ptr_, size_, ptr_);
+    }
+
+    tensor& operator=(const tensor& other)
+    {
+        if(this == &other) return *this;
+        WLL_ASSERT(other.access_ != memory_type::empty); // other is empty
+        WLL_ASSERT(this->access_ != memory_type::empty); // *this is empty
+        if (this->ptr_ != other.ptr_)
+        {
+            if (!(this->_has_same_dims(other.dims_.data())))
+                throw library_dimension_error(WLL_CURRENT_FUNCTION + "\ntensors have different dimensions.");
+            _data_copy_n(other.ptr_, size_, ptr_);
+        }
+        return *this;
+    }
+
+    tensor& operator=(tensor&& other)
+    {
+        if(this == &other) return *this;
+        WLL_ASSERT(other.access_ != memory_type::empty); // other is empty
+        WLL_ASSERT(this->access_ != memory_type::empty); // *this is empty
+        if (this->ptr_ != other.ptr_)
+        {
+            if (!(this->_has_same_dims(other.dims_.data())))
+                throw library_dimension_error(WLL_CURRENT_FUNCTION + "\ntensors have different dimensions.");
+            if (other.access_ == memory_type::proxy  ||
+                other.access_ == memory_type::shared ||
+                this->access_ == memory_type::proxy  ||
+                this->access_ == memory_type::shared)
+            {
+                _data_copy_n(other.ptr_, size_, ptr_);
+            }
+            else
+            {
+                this->_swap_pointers(std::move(other));
+            }
+        }
+        return *this;
+    }
+
+    template<typename U>
+    tensor& operator=(const tensor<U, _rank>& other)
+    {
+        if(this == &other) return *this;
+        WLL_ASSERT(other.access_ != memory_type::empty); // other is empty
+        WLL_ASSERT(this->access_ != memory_type::empty); // *this is empty
+        // tensors with difference value_type should not have the same ptr_
+        WLL_ASSERT((void*)(this->ptr_) != (void*)(other.ptr_));
+        _data_copy_n(other.ptr_, size_, ptr_);
+        return *this;
+    }
+
+    template<typename U>
+    tensor& operator=(tensor<U, _rank>&& other)
+    {
+        WLL_ASSERT(other.access_ != memory_type::empty); // other is empty
+        WLL_ASSERT(this->access_ != memory_type::empty); // *this is empty
+        // tensors with difference value_type should not have the same ptr_
+        WLL_ASSERT((void*)(this->ptr_) != (void*)(other.ptr_));
+        _data_copy_n(other.ptr_, size_, ptr_);
+        return *this;
+    }
+
+    template<typename Expr, typename = std::enable_if_t<is_tensor_expr_v<Expr>>>
+    tensor& operator=(const Expr& expr)
+    {
+        static_assert(Expr::_rank == _rank, "expression has a different rank");
+        WLL_ASSERT(this->access_ != memory_type::empty); // *this is empty
+        if (this->dims_ != expr.dimensions())
+            throw library_dimension_error(WLL_CURRENT_FUNCTION + "\ntensor and expression have different dimensions.");
+        _evaluate_expr(expr, ptr_, size_);
+        return *this;
+    }
+
+    template<typename Other>
+    tensor& operator+=(const Other& other)
+    {
+        return (*this) = (*this) + other;
+    }
+
+    template<typename Other>
+    tensor& operator-=(const Other& other)
+    {
+        return (*this) = (*this) - other;
+    }
+
+    template<typename Other>
+    tensor& operator*=(const Other& other)
+    {
+        return (*this) = (*this) * other;
+    }
+
+    template<typename Other>
+    tensor& operator/=(const Other& other)
+    {
+        return (*this) = (*this) / other;
+    }
+
+    [[nodiscard]] tensor clone(memory_type access = memory_type::result) const
+    {
+        WLL_ASSERT(this->access_ != memory_type::empty); // cannot clone an empty tensor
+        WLL_ASSERT(access == memory_type::owned || access == memory_type::manual ||
+                   access == memory_type::scratch || access == memory_type::result);
+        tensor ret(this->dims_, uninitialized, access);
+        _data_copy_n(ptr_, size_, ret.ptr_);
+        return ret;
+    }
+
+    ~tensor()
+    {
+        this->_destroy();
+    }
+
+    [[nodiscard]] constexpr size_t rank() const noexcept
+    {
+        return _rank;
+    }
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    [[nodiscard]] _dims_t dimensions() const noexcept
+    {
+        return dims_;
+    }
+
+    [[nodiscard]] size_t dimension(size_t level) const noexcept
+    {
+        return dims_[level];
+    }
+
+    [[nodiscard]] _strides_t strides() const noexcept
+    {
+        return strides_;
+    }
+
+    [[nodiscard]] size_t stride(size_t level) const noexcept
+    {
+        return strides_[level];
+    }
+
+    _ptr_t data() noexcept
+    {
+        return this->ptr_;
+    }
+
+    [[nodiscard]] _const_ptr_t data() const noexcept
+    {
+        return this->ptr_;
+    }
+
+    bool operator==(const tensor& other) const
+    {
+        if (this->dims_ != other.dims_)
+            return false;
+        if (this->ptr_ == other.ptr_)
+            return true;
+        return std::equal(this->cbegin(), this->cend(), other.cbegin());
+    }
+
+    template<typename... Idx>
+    value_type at(Idx... idx) const
+    {
+        static_assert(sizeof...(idx) == _rank);
+        return (*this)[_get_flat_idx(std::make_tuple(idx...))];
+    }
+
+    template<typename... Idx>
+    value_type& at(Idx... idx)
+    {
+        static_assert(sizeof...(idx) == _rank);
+        return (*this)[_get_flat_idx(std::make_tuple(idx...))];
+    }
+
+    template<typename... Idx>
+    value_type operator()(Idx... idx) const
+    {
+        static_assert(sizeof...(idx) == _rank);
+        return (*this)[_get_flat_idx_unsafe(std::make_tuple(idx...))];
+    }
+
+    template<typename... Idx>
+    value_type& operator()(Idx... idx)
+    {
+        static_assert(sizeof...(idx) == _rank);
+        return (*this)[_get_flat_idx_unsafe(std::make_tuple(idx...))];
+    }
+
+    template<typename IdxTuple>
+    value_type& _tuple_at(const IdxTuple& idx_tuple)
+    {
+        static_assert(std::tuple_size_v<IdxTuple> == _rank);
+        return this->_tuple_at_impl(idx_tuple, std::make_index_sequence<_rank>{});
+    }
+
+    template<typename IdxTuple>
+    value_type _tuple_at(const IdxTuple& idx_tuple) const
+    {
+        static_assert(std::tuple_size_v<IdxTuple> == _rank);
+        return this->_tuple_at_impl(idx_tuple, std::make_index_sequence<_rank>{});
+    }
+
+    value_type operator[](size_t idx) const
+    {
+        WLL_ASSERT(idx < size_); // index out of range
+        return ptr_[idx];
+    }
+
+    value_type& operator[](size_t idx)
+    {
+        WLL_ASSERT(idx < size_); // index out of range
+        return ptr_[idx];
+    }
+
+    [[nodiscard]] _const_ptr_t cbegin() const noexcept
+    {
+        WLL_ASSERT(ptr_ != nullptr);
+        return ptr_;
+    }
+
+    [[nodiscard]] _const_ptr_t cend() const noexcept
+    {
+        return this->cbegin() + size_;
+    }
+
+    [[nodiscard]] _const_ptr_t begin() const noexcept
+    {
+        return this->cbegin();
+    }
+
+    [[nodiscard]] _const_ptr_t end() const noexcept
+    {
+        return this->cend();
+    }
+
+    _ptr_t begin() noexcept
+    {
+        WLL_ASSERT(ptr_ != nullptr);
+        return ptr_;
+    }
+
+    _ptr_t end() noexcept
+    {
+        return this->begin() + size_;
+    }
+
+    [[nodiscard]] MTensor get_mtensor() const &
+    {
+        return _get_mtensor_lvalue();
+    }
+
+    MTensor get_mtensor() &&
+    {
+        return _get_mtensor_rvalue();
+    }
+
+    // call fn(value, i0, i1, ...) for every element in row-major order
+    template<typename Fn>
+    void for_each_with_index(Fn fn)
+    {
+        this->for_each_with_index(_dims_t{}, dims_, fn);
+    }
+
+    template<typename Fn>
+    void for_each_with_index(Fn fn) const
+    {
+        this->for_each_with_index(_dims_t{}, dims_, fn);
+    }
+
+    // call fn(value, i0, i1, ...) for every element in the sub-box [first, last)
+    template<typename Fn>
+    void for_each_with_index(const _dims_t& first, const _dims_t& last, Fn fn)
+    {
+        if (this->_check_box(first, last))
+            this->_for_each_with_index_impl<0>(ptr_, first, last, fn);
+    }
+
+    template<typename Fn>
+    void for_each_with_index(const _dims_t& first, const _dims_t& last, Fn fn) const
+    {
+        if (this->_check_box(first, last))
+            this->_for_each_with_index_impl<0>(_const_ptr_t(ptr_), first, last, fn);
+    }
+
+    template<typename... Indices>
+    [[nodiscard]] auto view(Indices... indices)
+    {
+        return tensor_view<value_type, _rank>(ptr_, dims_).view(indices...);
+    }
+
+    template<typename... Indices>
+    [[nodiscard]] auto view(Indices... indices) const
+    {
+        return tensor_view<const value_type, _rank>(ptr_, dims_).view(indices...);
+    }
+
+    template<typename InputIter>
+    void copy_data_from(InputIter src, size_t count = size_t(-1))
+    {
+        if (count == size_t(-1))
+            count = size_;
+        WLL_ASSERT(count == size_);
+        if constexpr (std::is_pointer_v<InputIter>)
+        {
+            _data_copy_n(src, count, this->ptr_);
+        }
+        else if (count > 0)
+        {
+            _ptr_t dest = this->ptr_;
+            for (size_t i = 0; i < count; ++i, ++src, ++dest)
+                *dest = _mtype_cast<value_type>(*src);
+        }
+    }
+
+    template<typename OutputIter>
+    void copy_data_to(OutputIter dest, size_t count = size_t(-1))
+    {
+        if (count == size_t(-1))
+            count = size_;
+        WLL_ASSERT(count == size_);
+        if constexpr (std::is_pointer_v<OutputIter>)
+        {
+            _data_copy_n(this->ptr_, count, dest);
+        }
+        else if (count > 0)
+        {
+            _ptr_t src = this->ptr_;
+            for (size_t i = 0; i < count; ++i, ++src, ++dest)
+                *dest = _mtype_cast<std::remove_reference_t<decltype(*dest)>>(*src);
+        }
+    }
+
+    template<typename IdxTuple>
+    size_t _get_flat_idx(const IdxTuple& idx_tuple) const
+    {
+        return _get_flat_idx_impl<true>(idx_tuple, std::make_index_sequence<_rank>{});
+    }
+
+    template<typename IdxTuple>
+    size_t _get_flat_idx_unsafe(const IdxTuple& idx_tuple) const noexcept
+    {
+        return _get_flat_idx_impl<false>(idx_tuple, std::make_index_sequence<_rank>{});
+    }
+
+    template<bool Check, typename IdxTuple, size_t... Is>
+    size_t _get_flat_idx_impl(const IdxTuple& idx_tuple, std::index_sequence<Is...>) const
+        noexcept(!Check)
+    {
+        return ((_get_level_idx<Check, Is>(std::get<Is>(idx_tuple)) * strides_[Is]) + ...);
+    }
+
+    template<bool Check, size_t Level, typename Idx>
+    size_t _get_level_idx(Idx plain_idx) const noexcept(!Check)
+    {
+        static_assert(std::is_integral_v<Idx>, "index must be of an integral type");
+        size_t unsigned_idx = size_t(plain_idx);
+        if constexpr (std::is_signed_v<Idx>)
+            if (plain_idx < Idx(0))
+                unsigned_idx += dims_[Level];
+        if constexpr (Check)
+        {
+            if (unsigned_idx >= dims_[Level])
+                throw std::out_of_range(WLL_CURRENT_FUNCTION + "\nindex out of range");
+        }
+        else
+            WLL_ASSERT(unsigned_idx < dims_[Level]);
+        return unsigned_idx;
+    }
+
+    template<typename IdxTuple, size_t... Is>
+    value_type& _tuple_at_impl(const IdxTuple& idx_tuple, std::index_sequence<Is...>)
+    {
+        return this->operator()(std::get<Is>(idx_tuple)...);
+    }
+
+    template<typename IdxTuple, size_t... Is>
+    value_type _tuple_at_impl(const IdxTuple& idx_tuple, std::index_sequence<Is...>) const
+    {
+        return this->operator()(std::get<Is>(idx_tuple)...);
+    }
+
+private:
+
+    template<size_t I = 0, typename Dims>
+    bool _has_same_dims(const Dims* other_dims)
+    {
+        if constexpr (I + 1 == _rank)
+            return (this->dims_[I] == size_t(other_dims[I])) && _has_same_dims<I + 1, Dims>(other_dims);
+        else
+            return this->dims_[_rank - 1] == size_t(other_dims[_rank - 1]);
+    }
+
+    static memory_type _resolve_access(memory_type access, size_t size) noexcept
+    {
+        return _resolve_tensor_access<value_type>(access, size);
+    }
+
+    void _allocate(bool zero_fill)
+    {
+        ptr_ = _allocate_tensor_data<value_type>(access_, _rank, dims_.data(), size_, zero_fill, mtensor_);
+    }
+
+    void _destroy()
+    {
+        _free_tensor_data(access_, ptr_, mtensor_);
+        ptr_     = nullptr;
+        mtensor_ = nullptr;
+        access_  = memory_type::empty;
+    }
+
+    void _release_ownership()
+    {
+        // destruct the object without free resource, manual tensor only
+        WLL_ASSERT(access_ == memory_type::manual);
+        ptr_     = nullptr;
+        mtensor_ = nullptr;
+        access_  = memory_type::empty;
+    }
+
+    [[nodiscard]] MTensor _get_mtensor_lvalue() const
+    {
+        WLL_ASSERT(access_ != memory_type::empty);
+
+        return _make_mtensor_copy(_const_ptr_t(ptr_), size_, _rank, dims_.data());
+    }
+
+    MTensor _get_mtensor_rvalue()
+    {
+        WLL_ASSERT(access_ != memory_type::empty);
+        if (access_ == memory_type::manual)
+        {
+            // return the containing mtensor and destroy *this
+            MTensor ret = this->mtensor_;
+            this->_release_ownership();
+            return ret;
+        }
+        else // access == owned / proxy / shared / scratch
+        {
+            // return a copy
+            return _get_mtensor_lvalue();
+        }
+    }
+
+    template<typename Other>
+    void _swap_pointers(Other&& other)
+    {
+        WLL_ASSERT(this->access_ == memory_type::owned ||
+                   this->access_ == memory_type::manual ||
+                   this->access_ == memory_type::scratch); // only tensors own data can swap
+        WLL_ASSERT(other.access_ == memory_type::owned ||
+                   other.access_ == memory_type::manual ||
+                   other.access_ == memory_type::scratch);
+        if (!(this->_has_same_dims(other.dims_.data())))
+            throw library_dimension_error(WLL_CURRENT_FUNCTION + "\ntensors have different dimensions.");
+        std::swap(this->ptr_, other.ptr_);
+        std::swap(this->mtensor_, other.mtensor_);
+        std::swap(this->access_, other.access_);
+    }
+
+    template<size_t Level, typename Data>
+    static auto _get_init_data_dims_impl(_dims_t& dims, const Data& data) noexcept
+        -> std::enable_if_t<Level + 1 != _rank>
+    {
+        const size_t size = data.size();
+        WLL_ASSERT(size > 0);
+        if (dims[Level] == size_t(0))
+            dims[Level] = size;
+        else
+            WLL_ASSERT(dims[Level] == size); // shape of the array should be regular
+
+        for (const auto& sub_data : data)
+            _get_init_data_dims_impl<Level + 1>(dims, sub_data);
+    }
+
+    template<size_t Level, typename Data>
+    static auto _get_init_data_dims_impl(_dims_t& dims, const Data& data) noexcept
+        -> std::enable_if_t<Level + 1 == _rank>
+    {
+        const size_t size = data.size();
+        WLL_ASSERT(size > 0);
+        if (dims[Level] == size_t(0))
+            dims[Level] = size;
+        else
+            WLL_ASSERT(dims[Level] == size); // shape of the array should be regular
+    }
+
+    static _dims_t _get_init_data_dims(const _init_data_t& data) noexcept
+    {
+        _dims_t dims ={};
+        _get_init_data_dims_impl<0>(dims, data);
+        return dims;
+    }
+
+    static _dims_t _get_init_dims(const _init_dims_t& dims, const _init_data_t& data) noexcept
+    {
+        return (dims.size() == 0) ? _get_init_data_dims(data) : _convert_to_dims_array<_rank>(dims);
+    }
+
+    [[nodiscard]] bool _check_box(const _dims_t& first, const _dims_t& last) const
+    {
+        bool is_empty = false;
+        for (size_t i = 0; i < _rank; ++i)
+        {
+            if (first[i] > last[i] || last[i] > dims_[i])
+                throw std::out_of_range(WLL_CURRENT_FUNCTION + "\nbox out of range");
+            is_empty = is_empty || (first[i] == last[i]);
+        }
+        return !is_empty;
+    }
+
+    template<size_t Level, typename Ptr, typename Fn, typename... Idx>
+    void _for_each_with_index_impl(Ptr ptr, const _dims_t& first, const _dims_t& last,
+                                   Fn& fn, Idx... idx) const
+    {
+        // ptr points to the element (idx..., 0, 0, ...)
+        if constexpr (Level + 1 == _rank)
+        {
+            ptr += first[Level];
+            for (size_t i = first[Level]; i < last[Level]; ++i, ++ptr)
+                fn(*ptr, idx..., i);
+        }
+        else
+        {
+            for (size_t i = first[Level]; i < last[Level]; ++i)
+                this->_for_each_with_index_impl<Level + 1>(
+                    ptr + i * strides_[Level], first, last, fn, idx..., i);
+        }
+    }
+
+    template<size_t Level, typename Data>
+    void _fill_init_data_impl(_ptr_t& ptr, const Data& data)
+    {
+        static_assert(Level + 1 <= _rank);
+        const size_t size = data.size();
+        const size_t pad_size = this->dims_[Level] - size;
+        WLL_ASSERT(size > 0 && pad_size >= 0);
+        if constexpr (Level + 1 == _rank)
+        {
+            for (const auto& value : data)
+                *(ptr++) = value;
+            ptr += pad_size;
+        }
+        else
+        {
+            for (const auto& sub_data : data)
+                this->_fill_init_data_impl<Level + 1>(ptr, sub_data);
+            ptr += strides_[Level] * pad_size;
+        }
+    }
+
+    void _fill_init_data(const _init_data_t& data)
+    {
+        WLL_ASSERT(this->access_ != memory_type::empty);
+        _ptr_t ptr = ptr_;
+        this->_fill_init_data_impl<0>(ptr, data);
+    }
+
+
+private:
+    _dims_t    dims_{};
+    _strides_t strides_ = _row_major_strides<size_t>(dims_);
+    size_t     size_{};
+    _ptr_t     ptr_ = nullptr;
+    MTensor    mtensor_ = nullptr;
+    memory_type access_ = memory_type::empty;
+};
+
+template<typename T>
+using list = tensor<T, 1>;
+template<typename T>
+using matrix = tensor<T, 2>;
+
+
+// tensor whose rank is known only at run time, so that rank-polymorphic functions
+// are compiled once; data is stored in row-major order as in tensor<T, Rank>
+template<typename T>
+class any_tensor
+{
+public:
+    using value_type   = T;
+    using _ptr_t       = value_type*;
+    using _const_ptr_t = const value_type*;
+    using _dims_t      = std::vector<size_t>;
+    using _strides_t   = std::vector<size_t>;
+
+    template<typename U>
+    friend class any_tensor;
+
+    any_tensor() noexcept = default;
+
+    any_tensor(MTensor mtensor, memory_type access) :
+        mtensor_{mtensor}, access_{access}
+    {
+        WLL_ASSERT(access_ == memory_type::owned ||
+                   access_ == memory_type::proxy ||
+                   access_ == memory_type::shared);
+
+        const size_t rank     = size_t(global_lib_data->MTensor_getRank(mtensor));
+        const mint*  dims_ptr = global_lib_data->MTensor_getDimensions(mtensor);
+        dims_.assign(dims_ptr, dims_ptr + rank);
+        strides_ = _make_strides(dims_);
+        size_    = global_lib_data->MTensor_getFlattenedLength(mtensor);
+
+        int   mtype   = int(global_lib_data->MTensor_getType(mtensor));
+        void* src_ptr = _get_mtensor_data(mtensor, mtype);
+        bool  do_copy = (mtype != derive_tensor_data_type<value_type>::strict_type_v);
+
+        if (access_ == memory_type::owned)
+            do_copy = true; // do copy anyway
+
+        if (do_copy)
+        {
+            WLL_ASSERT(access_ == memory_type::owned ||
+                       access_ == memory_type::proxy);
+            mtensor_ = nullptr;
+            access_  = memory_type::owned; // *this will own data after copy
+            this->_allocate(false);
+            try
+            {
+                _copy_from_mtensor_data(src_ptr, mtype, size_, ptr_);
+            }
+            catch (...)
+            {
+                // the destructor does not run when a constructor throws
+                _free_tensor_data(access_, ptr_, mtensor_);
+                throw;
+            }
+        }
+        else // do_copy == false
+        {
+            WLL_ASSERT(access_ == memory_type::proxy ||
+                       access_ == memory_type::shared);
+            ptr_ = reinterpret_cast<_ptr_t>(src_ptr);
+        }
+    }
+
+    explicit any_tensor(_dims_t dims, memory_type access = memory_type::result) :
+        dims_{std::move(dims)}, strides_{_make_strides(dims_)}, size_{_flattened_size(dims_)},
+        access_{_resolve_tensor_access<value_type>(access, size_)}
+    {
+        this->_allocate(true);
+    }
+
+    any_tensor(_dims_t dims, uninitialized_t, memory_type access = memory_type::result) :
+        dims_{std::move(dims)}, strides_{_make_strides(dims_)}, size_{_flattened_size(dims_)},
+        access_{_resolve_tensor_access<value_type>(access, size_)}
+    {
+        this->_allocate(false);
+    }
+
+    template<typename U, size_t Rank>
+    explicit any_tensor(const tensor<U, Rank>& other, memory_type access = memory_type::result) :
+        any_tensor(_to_dims(other.dimensions()), uninitialized, access)
+    {
+        _data_copy_n(other.data(), size_, ptr_);
+    }
+
+    template<typename Expr, typename = std::enable_if_t<is_tensor_expr_v<Expr>>>
+    any_tensor(const Expr& expr, memory_type access = memory_type::result) :
+        any_tensor(_to_dims(expr.dimensions()), uninitialized, access)
+    {
+        _evaluate_expr(expr, ptr_, size_);
+    }
+
+    any_tensor(const any_tensor& other) :
+        any_tensor(other.dims_, uninitialized)
+    {
+        _data_copy_n(other.ptr_, size_, ptr_);
+    }
+
+    any_tensor(any_tensor&& other) noexcept :
+        dims_{std::move(other.dims_)}, strides_{std::move(other.strides_)}, size_{other.size_}
+    {
+        std::swap(ptr_, other.ptr_);
+        std::swap(access_, other.access_);
+        std::swap(mtensor_, other.mtensor_);
+    }
+
+    template<typename U>
+    explicit any_tensor(const any_tensor<U>& other) :
+        any_tensor(other.dims_, uninitialized)
+    {
+        _data_copy_n(other.ptr_, size_, ptr_);
+    }
+
+    any_tensor& operator=(const any_tensor& other)
+    {
+        if(this == &other) return *this;
+        WLL_ASSERT(other.access_ != memory_type::empty); // other is empty
+        WLL_ASSERT(this->access_ != memory_type::empty); // *this is empty
+        if (this->ptr_ != other.ptr_)
+        {
+            if (this->dims_ != other.dims_)
+                throw library_dimension_error(WLL_CURRENT_FUNCTION + "\ntensors have different dimensions.");
+            _data_copy_n(other.ptr_, size_, ptr_);
+        }
+        return *this;
+    }
+
+    any_tensor& operator=(any_tensor&& other)
+    {
+        if(this == &other) return *this;
+        WLL_ASSERT(other.access_ != memory_type::empty); // other is empty
+        WLL_ASSERT(this->access_ != memory_type::empty); // *this is empty
+        if (this->ptr_ != other.ptr_)
+        {
+            if (this->dims_ != other.dims_)
+                throw library_dimension_error(WLL_CURRENT_FUNCTION + "\ntensors have different dimensions.");
+            if (other.access_ == memory_type::proxy  ||
+                other.access_ == memory_type::shared ||
+                this->access_ == memory_type::proxy  ||
+                this->access_ == memory_type::shared)
+            {
+                _data_copy_n(other.ptr_, size_, ptr_);
+            }
+            else
+            {
+                std::swap(this->ptr_, other.ptr_);
+                std::swap(this->mtensor_, other.mtensor_);
+                std::swap(this->access_, other.access_);
+            }
+        }
+        return *this;
+    }
+
+    template<typename U>
+    any_tensor& operator=(const any_tensor<U>& other)
+    {
+        WLL_ASSERT(other.access_ != memory_type::empty); // other is empty
+        WLL_ASSERT(this->access_ != memory_type::empty); // *this is empty
+        if (this->dims_ != other.dims_)
+            throw library_dimension_error(WLL_CURRENT_FUNCTION + "\ntensors have different dimensions.");
+        _data_copy_n(other.ptr_, size_, ptr_);
+        return *this;
+    }
+
+    [[nodiscard]] any_tensor clone(memory_type access = memory_type::result) const
+    {
+        WLL_ASSERT(this->access_ != memory_type::empty); // cannot clone an empty tensor
+        WLL_ASSERT(access == memory_type::owned || access == memory_type::manual ||
+                   access == memory_type::scratch || access == memory_type::result);
+        any_tensor ret(this->dims_, uninitialized, access);
+        _data_copy_n(ptr_, size_, ret.ptr_);
+        return ret;
+    }
+
+    ~any_tensor()
+    {
+        _free_tensor_data(access_, ptr_, mtensor_);
+    }
+
+    [[nodiscard]] size_t rank() const noexcept
+    {
+        return dims_.size();
+    }
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    [[nodiscard]] const _dims_t& dimensions() const noexcept
+    {
+        return dims_;
+    }
+
+    [[nodiscard]] size_t dimension(size_t level) const noexcept
+    {
+        WLL_ASSERT(level < dims_.size());
+        return dims_[level];
+    }
+
+    [[nodiscard]] const _strides_t& strides() const noexcept
+    {
+        return strides_;
+    }
+
+    [[nodiscard]] size_t stride(size_t level) const noexcept
+    {
+        WLL_ASSERT(level < strides_.size());
+        return strides_[level];
+    }
+
+    _ptr_t data() noexcept
+    {
+        return this->ptr_;
+    }
+
+    [[nodiscard]] _const_ptr_t data() const noexcept
+    {
+        return this->ptr_;
+    }
+
+    bool operator==(const any_tensor& other) const
+    {
+        if (this->dims_ != other.dims_)
+            return false;
+        if (this->ptr_ == other.ptr_)
+            return true;
+        return std::equal(this->cbegin(), this->cend(), other.cbegin());
+    }
+
+    // the number of indices is checked against the rank, and each index against its dimension
+    template<typename... Idx>
+    value_type at(Idx... idx) const
+    {
+        return (*this)[_get_flat_idx<true>(std::index_sequence_for<Idx...>{}, idx...)];
+    }
+
+    template<typename... Idx>
+    value_type& at(Idx... idx)
+    {
+        return (*this)[_get_flat_idx<true>(std::index_sequence_for<Idx...>{}, idx...)];
+    }
+
+    template<typename... Idx>
+    value_type operator()(Idx... idx) const
+    {
+        return (*this)[_get_flat_idx<false>(std::index_sequence_for<Idx...>{}, idx...)];
+    }
+
+    template<typename... Idx>
+    value_type& operator()(Idx... idx)
+    {
+        return (*this)[_get_flat_idx<false>(std::index_sequence_for<Idx...>{}, idx...)];
+    }
+
+    value_type operator[](size_t idx) const
+    {
+        WLL_ASSERT(idx < size_); // index out of range
+        return ptr_[idx];
+    }
+
+    value_type& operator[](size_t idx)
+    {
+        WLL_ASSERT(idx < size_); // index out of range
+        return ptr_[idx];
+    }
+
+    [[nodiscard]] _const_ptr_t cbegin() const noexcept
+    {
+        WLL_ASSERT(ptr_ != nullptr);
+        return ptr_;
+    }
+
+    [[nodiscard]] _const_ptr_t cend() const noexcept
+    {
+        return this->cbegin() + size_;
+    }
+
+    [[nodiscard]] _const_ptr_t begin() const noexcept
+    {
+        return this->cbegin();
+    }
+
+    [[nodiscard]] _const_ptr_t end() const noexcept
+    {
+        return this->cend();
+    }
+
+    _ptr_t begin() noexcept
+    {
+        WLL_ASSERT(ptr_ != nullptr);
+        return ptr_;
+    }
+
+    _ptr_t end() noexcept
+    {
+        return this->begin() + size_;
+    }
+
+    // the data seen with a fixed rank, e.g. to dispatch to rank-specific code
+    template<size_t Rank>
+    [[nodiscard]] tensor_view<value_type, Rank> view()
+    {
+        return tensor_view<value_type, Rank>(ptr_, this->_fixed_rank_dims<Rank>());
+    }
+
+    template<size_t Rank>
+    [[nodiscard]] tensor_view<const value_type, Rank> view() const
+    {
+        return tensor_view<const value_type, Rank>(ptr_, this->_fixed_rank_dims<Rank>());
+    }
+
+    [[nodiscard]] MTensor get_mtensor() const &
+    {
+        WLL_ASSERT(access_ != memory_type::empty);
+        return _make_mtensor_copy(_const_ptr_t(ptr_), size_, dims_.size(), dims_.data());
+    }
+
+    MTensor get_mtensor() &&
+    {
+        WLL_ASSERT(access_ != memory_type::empty);
+        if (access_ != memory_type::manual)
+            return _make_mtensor_copy(_const_ptr_t(ptr_), size_, dims_.size(), dims_.data());
+        // return the containing mtensor and release *this
+        MTensor ret = mtensor_;
+        ptr_     = nullptr;
+        mtensor_ = nullptr;
+        access_  = memory_type::empty;
+        return ret;
+    }
+
+private:
+    template<size_t Rank>
+    static _dims_t _to_dims(const std::array<size_t, Rank>& dims)
+    {
+        return _dims_t(dims.begin(), dims.end());
+    }
+
+    static _strides_t _make_strides(const _dims_t& dims)
+    {
+        _strides_t strides(dims.size());
+        size_t stride = 1;
+        for (size_t i = dims.size(); i > 0; --i)
+        {
+            strides[i - 1] = stride;
+            stride *= dims[i - 1];
+        }
+        return strides;
+    }
+
+    template<size_t Rank>
+    std::array<size_t, Rank> _fixed_rank_dims() const
+    {
+        if (dims_.size() != Rank)
+            throw library_rank_error(WLL_CURRENT_FUNCTION + "\ntensor has a different rank.");
+        std::array<size_t, Rank> dims;
+        std::copy_n(dims_.begin(), Rank, dims.begin());
+        return dims;
+    }
+
+    template<bool Check, size_t... Is, typename... Idx>
+    size_t _get_flat_idx(std::index_sequence<Is...>, Idx... idx) const noexcept(!Check)
+    {
+        if constexpr (Check)
+        {
+            if (sizeof...(Idx) != dims_.size())
+                throw library_rank_error(WLL_CURRENT_FUNCTION + "\nnumber of indices does not match the rank.");
+        }
+        else
+            WLL_ASSERT(sizeof...(Idx) == dims_.size());
+        return ((_get_level_idx<Check>(Is, idx) * strides_[Is]) + ... + size_t(0));
+    }
+
+    template<bool Check, typename Idx>
+    size_t _get_level_idx(size_t level, Idx plain_idx) const noexcept(!Check)
+    {
+        static_assert(std::is_integral_v<Idx>, "index must be of an integral type");
+        size_t unsigned_idx = size_t(plain_idx);
+        if constexpr (std::is_signed_v<Idx>)
+            if (plain_idx < Idx(0))
+                unsigned_idx += dims_[level];
+        if constexpr (Check)
+        {
+            if (unsigned_idx >= dims_[level])
+                throw std::out_of_range(WLL_CURRENT_FUNCTION + "\nindex out of range");
+        }
+        else
+            WLL_ASSERT(unsigned_idx < dims_[level]);
+        return unsigned_idx;
+    }
+
+    void _allocate(bool zero_fill)
+    {
+        ptr_ = _allocate_tensor_data<value_type>(access_, dims_.size(), dims_.data(), size_, zero_fill, mtensor_);
+    }
+
+private:
+    _dims_t    dims_{};
+    _strides_t strides_{};
+    size_t     size_{};
+    _ptr_t     ptr_ = nullptr;
+    MTensor    mtensor_ = nullptr;
+    memory_type access_ = memory_type::empty;
+};
+
+
+
+// lazy elementwise expressions, evaluated in one pass into the destination;
+// lower-rank operands are broadcast over the trailing dimensions. an expression refers to
+// tensor lvalues it is built from, which must outlive its evaluation, and keeps tensor
+// rvalues alive itself; an exported function may return an expression over the arguments
+// it takes by reference, which live until the result is submitted, but not over its locals
+template<typename T>
+constexpr bool _is_expr_scalar_v = std::is_arithmetic_v<T> || is_std_complex_v<T>;
+
+template<typename T>
+struct _is_expr_operand :
+    std::bool_constant<is_tensor_expr_v<T>> {};
+template<typename T, size_t Rank>
+struct _is_expr_operand<tensor<T, Rank>> :
+    std::true_type {};
+template<typename T>
+constexpr bool _is_expr_operand_v = _is_expr_operand<T>::value;
+
+template<typename T, size_t Rank>
+class _expr_tensor : public _expr_base
+{
+public:
+    using value_type = T;
+    static constexpr size_t _rank = Rank;
+    using _dims_t = std::array<size_t, _rank>;
+
+    // operator[] reads the j-th element from start; at reads column j of row row, where
+    // rows are period elements long and operands of that period repeat on every row
+    struct cursor
+    {
+        const T* ptr_;
+        size_t   row_stride_;
+        const T& operator[](size_t j) const noexcept { return ptr_[j]; }
+        const T& at(size_t row, size_t j) const noexcept { return ptr_[row * row_stride_ + j]; }
+    };
+
+    explicit _expr_tensor(const tensor<T, Rank>& t) noexcept :
+        ptr_{t.data()}, dims_{t.dimensions()}, size_{t.size()} {}
+
+    // an rvalue operand is moved into storage shared by the node and all copies of it
+    explicit _expr_tensor(tensor<T, Rank>&& t) :
+        _expr_tensor(std::make_shared<const tensor<T, Rank>>(std::move(t))) {}
+
+    [[nodiscard]] _dims_t dimensions() const noexcept { return dims_; }
+    [[nodiscard]] size_t _period() const noexcept { return size_; }
+    [[nodiscard]] size_t _next_period(size_t period) const noexcept
+    {
+        return size_ > period ? size_ : size_t(-1);
+    }
+    [[nodiscard]] cursor _cursor(size_t start, size_t period) const noexcept
+    {
+        return {ptr_ + start % size_, size_ > period ? period : 0};
+    }
+
+private:
+    explicit _expr_tensor(std::shared_ptr<const tensor<T, Rank>> owner) noexcept :
+        ptr_{owner->data()}, dims_{owner->dimensions()}, size_{owner->size()}, owner_{std::move(owner)} {}
+
+    const T* ptr_;
+    _dims_t  dims_;
+    size_t   size_;
+    std::shared_ptr<const tensor<T, Rank>> owner_; // empty for lvalue operands
+};
+
+template<typename T>
+class _expr_scalar : public _expr_base
+{
+public:
+    using value_type = T;
+    static constexpr size_t _rank = 0;
+    using _dims_t = std::array<size_t, _rank>;
+
+    struct cursor
+    {
+        T value_;
+        const T& operator[](size_t) const noexcept { return value_; }
+        const T& at(size_t, size_t) const noexcept { return value_; }
+    };
+
+    explicit _expr_scalar(const T& value) noexcept :
+        value_{value} {}
+
+    [[nodiscard]] _dims_t dimensions() const noexcept { return {}; }
+    [[nodiscard]] size_t _period() const noexcept { return size_t(-1); }
+    [[nodiscard]] size_t _next_period(size_t) const noexcept { return size_t(-1); }
+    [[nodiscard]] cursor _cursor(size_t, size_t) const noexcept { return {value_}; }
+
+private:
+    T value_;
+};
+
+template<typename Op, typename E>
+class _expr_unary : public _expr_base
+{
+public:
+    using value_type = decltype(Op{}(std::declval<typename E::value_type>()));
+    static constexpr size_t _rank = E::_rank;
+    using _dims_t = std::array<size_t, _rank>;
+
+    struct cursor
+    {
+        typename E::cursor e_;
+        value_type operator[](size_t j) const { return Op{}(e_[j]); }
+        value_type at(size_t row, size_t j) const { return Op{}(e_.at(row, j)); }
+    };
+
+    explicit _expr_unary(const E& e) :
+        e_{e} {}
+
+    [[nodiscard]] _dims_t dimensions() const noexcept { return e_.dimensions(); }
+    [[nodiscard]] size_t _period() const noexcept { return e_._period(); }
+    [[nodiscard]] size_t _next_period(size_t period) const noexcept { return e_._next_period(period); }
+    [[nodiscard]] cursor _cursor(size_t start, size_t period) const noexcept
+    {
+        return {e_._cursor(start, period)};
+    }
+
+private:
+    E e_;
+};
+
+template<typename Op, typename L, typename R>
+class _expr_binary : public _expr_base
+{
+public:
+    using value_type = decltype(Op{}(std::declval<typename L::value_type>(),
+                                     std::declval<typename R::value_type>()));
+    static constexpr size_t _rank = std::max(L::_rank, R::_rank);
+    using _dims_t = std::array<size_t, _rank>;
+
+    struct cursor
+    {
+        typename L::cursor l_;
+        typename R::cursor r_;
+        value_type operator[](size_t j) const { return Op{}(l_[j], r_[j]); }
+        value_type at(size_t row, size_t j) const { return Op{}(l_.at(row, j), r_.at(row, j)); }
+    };
+
+    _expr_binary(const L& l, const R& r) :
+        l_{l}, r_{r}
+    {
+        if constexpr (L::_rank >= R::_rank)
+            _check_broadcast(l_.dimensions(), r_.dimensions());
+        else
+            _check_broadcast(r_.dimensions(), l_.dimensions());
+    }
+
+    [[nodiscard]] _dims_t dimensions() const noexcept
+    {
+        if constexpr (L::_rank >= R::_rank)
+            return l_.dimensions();
+        else
+            return r_.dimensions();
+    }
+
+    [[nodiscard]] size_t _period() const noexcept
+    {
+        return std::min(l_._period(), r_._period());
+    }
+
+    // the shortest period of the operands that is longer than period
+    [[nodiscard]] size_t _next_period(size_t period) const noexcept
+    {
+        return std::min(l_._next_period(period), r_._next_period(period));
+    }
+
+    [[nodiscard]] cursor _cursor(size_t start, size_t period) const noexcept
+    {
+        return {l_._cursor(start, period), r_._cursor(start, period)};
+    }
+
+private:
+    template<size_t HighRank, size_t LowRank>
+    static void _check_broadcast(const std::array<size_t, HighRank>& high,
+                                 const std::array<size_t, LowRank>& low)
+    {
+        if (!std::equal(low.begin(), low.end(), high.end() - LowRank))
+            throw library_dimension_error(WLL_CURRENT_FUNCTION +
+                "\noperand dimensions do not match the trailing dimensions of the other operand.");
+    }
+
+    L l_;
+    R r_;
+};
+
+template<typename T>
+auto _as_expr(T&& operand)
+{
+    using operand_t = std::decay_t<T>;
+    if constexpr (is_tensor_expr_v<operand_t>)
+        return operand_t(std::forward<T>(operand));
+    else if constexpr (_is_expr_scalar_v<operand_t>)
+        return _expr_scalar<operand_t>(operand);
+    else
+        return _expr_tensor<typename operand_t::value_type, operand_t::_rank>(std::forward<T>(operand));
+}
+
+template<typename T>
+using _as_expr_t = decltype(_as_expr(std::declval<T>()));
+
+template<typename L, typename R>
+constexpr bool _is_expr_operands_v =
+    (_is_expr_operand_v<L> && (_is_expr_operand_v<R> || _is_expr_scalar_v<R>)) ||
+    (_is_expr_scalar_v<L> && _is_expr_operand_v<R>);
+
+template<typename Op, typename L, typename R>
+auto _make_binary_expr(L&& l, R&& r)
+{
+    return _expr_binary<Op, _as_expr_t<L>, _as_expr_t<R>>(_as_expr(std::forward<L>(l)),
+                                                          _as_expr(std::forward<R>(r)));
+}
+
+constexpr size_t _expr_short_period = 64;   // periods below this are evaluated by columns
+constexpr size_t _expr_block_size   = 4096; // elements of a block of rows of a short period
+
+template<typename Expr, typename Dest>
+void _evaluate_expr(const Expr& expr, Dest* dest, size_t size)
+{
+    if (size == 0)
+        return;
+    // every operand repeats with a period that is a multiple of the shortest one,
+    // so the inner loop is a plain unit-stride loop over all operands
+    const size_t period = std::min(expr._period(), size);
+    if (period >= _expr_short_period)
+    {
+        for (size_t start = 0; start < size; start += period)
+        {
+            const auto cursor   = expr._cursor(start, period);
+            Dest*      dest_ptr = dest + start;
+            for (size_t j = 0; j < period; ++j)
+                dest_ptr[j] = _mtype_cast<Dest>(cursor[j]);
+        }
+        return;
+    }
+
+    // a short period, e.g. a length-3 list broadcast over an n x 3 matrix: blocks of rows of
+    // period elements, which do not cross a multiple of the next longer period, are evaluated
+    // column by column, so the inner loop runs over the rows with the short operands fixed
+    const size_t next_period    = std::min(expr._next_period(period), size);
+    const size_t rows_per_block = (_expr_block_size + period - 1) / period;
+    for (size_t start = 0; start < size;)
     {
-        return this->cend();
+        const size_t rows     = std::min(rows_per_block, (next_period - start % next_period) / period);
+        const auto   cursor   = expr._cursor(start, period);
+        Dest*        dest_ptr = dest + start;
+        for (size_t j = 0; j < period; ++j)
+            for (size_t row = 0; row < rows; ++row)
+                dest_ptr[row * period + j] = _mtype_cast<Dest>(cursor.at(row, j));
+        start += rows * period;
+    }
+}
+
+template<typename Expr, typename = std::enable_if_t<is_tensor_expr_v<Expr>>>
+auto evaluate(const Expr& expr, memory_type access = memory_type::result)
+{
+    return tensor<typename Expr::value_type, Expr::_rank>(expr, access);
+}
+
+#define WLL_DEFINE_EXPR_OPERATOR(name, op)                                                  \
+struct _expr_op_##name                                                                      \
+{                                                                                           \
+    template<typename X, typename Y>                                                        \
+    auto operator()(const X& x, const Y& y) const { return x op y; }                        \
+};                                                                                          \
+template<typename L, typename R, typename = std::enable_if_t<                               \
+    _is_expr_operands_v<std::decay_t<L>, std::decay_t<R>>>>                                 \
+auto operator op(L&& l, R&& r)                                                              \
+{                                                                                           \
+    return _make_binary_expr<_expr_op_##name>(std::forward<L>(l), std::forward<R>(r));      \
+}
+
+WLL_DEFINE_EXPR_OPERATOR(plus, +)
+WLL_DEFINE_EXPR_OPERATOR(minus, -)
+WLL_DEFINE_EXPR_OPERATOR(multiplies, *)
+WLL_DEFINE_EXPR_OPERATOR(divides, /)
+#undef WLL_DEFINE_EXPR_OPERATOR
+
+struct _expr_op_negate
+{
+    template<typename X>
+    auto operator()(const X& x) const { return -x; }
+};
+template<typename E, typename = std::enable_if_t<_is_expr_operand_v<std::decay_t<E>>>>
+auto operator-(E&& e)
+{
+    return _expr_unary<_expr_op_negate, _as_expr_t<E>>(_as_expr(std::forward<E>(e)));
+}
+
+#define WLL_DEFINE_EXPR_FUNCTION(fn)                                                        \
+struct _expr_fn_##fn                                                                        \
+{                                                                                           \
+    template<typename X>                                                                    \
+    auto operator()(const X& x) const { using std::fn; return fn(x); }                      \
+};                                                                                          \
+template<typename E, typename = std::enable_if_t<_is_expr_operand_v<std::decay_t<E>>>>      \
+auto fn(E&& e)                                                                              \
+{                                                                                           \
+    return _expr_unary<_expr_fn_##fn, _as_expr_t<E>>(_as_expr(std::forward<E>(e)));        \
+}
+
+WLL_DEFINE_EXPR_FUNCTION(abs)
+WLL_DEFINE_EXPR_FUNCTION(sqrt)
+WLL_DEFINE_EXPR_FUNCTION(cbrt)
+WLL_DEFINE_EXPR_FUNCTION(exp)
+WLL_DEFINE_EXPR_FUNCTION(log)
+WLL_DEFINE_EXPR_FUNCTION(log10)
+WLL_DEFINE_EXPR_FUNCTION(sin)
+WLL_DEFINE_EXPR_FUNCTION(cos)
+WLL_DEFINE_EXPR_FUNCTION(tan)
+WLL_DEFINE_EXPR_FUNCTION(asin)
+WLL_DEFINE_EXPR_FUNCTION(acos)
+WLL_DEFINE_EXPR_FUNCTION(atan)
+WLL_DEFINE_EXPR_FUNCTION(sinh)
+WLL_DEFINE_EXPR_FUNCTION(cosh)
+WLL_DEFINE_EXPR_FUNCTION(tanh)
+WLL_DEFINE_EXPR_FUNCTION(floor)
+WLL_DEFINE_EXPR_FUNCTION(ceil)
+WLL_DEFINE_EXPR_FUNCTION(round)
+#undef WLL_DEFINE_EXPR_FUNCTION
+
+#define WLL_DEFINE_EXPR_FUNCTION2(fn)                                                       \
+struct _expr_fn_##fn                                                                        \
+{                                                                                           \
+    template<typename X, typename Y>                                                        \
+    auto operator()(const X& x, const Y& y) const { using std::fn; return fn(x, y); }       \
+};                                                                                          \
+template<typename L, typename R, typename = std::enable_if_t<                               \
+    _is_expr_operands_v<std::decay_t<L>, std::decay_t<R>>>>                                 \
+auto fn(L&& l, R&& r)                                                                       \
+{                                                                                           \
+    return _make_binary_expr<_expr_fn_##fn>(std::forward<L>(l), std::forward<R>(r));        \
+}
+
+WLL_DEFINE_EXPR_FUNCTION2(pow)
+WLL_DEFINE_EXPR_FUNCTION2(atan2)
+#undef WLL_DEFINE_EXPR_FUNCTION2
+
+
+// growable tensor whose leading dimension is not known in advance;
+// rows are appended to chunks that are never moved, and finish() copies each
+// element once, or not at all if the first chunk is exactly filled
+template<typename T, size_t Rank = 1>
+class tensor_builder
+{
+public:
+    using value_type   = T;
+    static constexpr size_t _rank = Rank;
+    using _ptr_t       = value_type*;
+    using _dims_t      = std::array<size_t, _rank>;
+    using _row_dims_t  = std::array<size_t, _rank - 1>;
+    static_assert(_rank > 0);
+
+    static constexpr size_t _min_chunk_size = size_t(1) << 12;
+    static constexpr size_t _max_chunk_size = size_t(1) << 22;
+
+    explicit tensor_builder(_row_dims_t row_dims = {}, size_t reserve_rows = 0) :
+        row_dims_{row_dims}, row_size_{_flattened_size(row_dims)}, reserve_rows_{reserve_rows}
+    {
+        WLL_ASSERT(row_size_ > 0); // rows should not be empty
+    }
+
+    tensor_builder(const tensor_builder&) = delete;
+    tensor_builder(tensor_builder&&) noexcept = default;
+    tensor_builder& operator=(const tensor_builder&) = delete;
+    tensor_builder& operator=(tensor_builder&&) noexcept = default;
+
+    // capacity of the first chunk, which is returned without copying if filled exactly
+    void reserve(size_t rows)
+    {
+        WLL_ASSERT(chunks_.empty()); // should reserve before adding any rows
+        reserve_rows_ = rows;
+    }
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return full_rows_ + (chunks_.empty() ? 0 : size_t(ptr_ - chunks_.back().data()) / row_size_);
+    }
+
+    [[nodiscard]] bool empty() const noexcept
+    {
+        return this->size() == 0;
+    }
+
+    [[nodiscard]] _row_dims_t row_dimensions() const noexcept
+    {
+        return row_dims_;
+    }
+
+    void push_back(const value_type& value)
+    {
+        static_assert(_rank == 1, "use push_row or emplace_row for builders of rank > 1");
+        if (ptr_ == end_)
+            this->_grow();
+        *(ptr_++) = value;
+    }
+
+    // returns the storage of a new row, whose elements should all be assigned
+    _ptr_t emplace_row()
+    {
+        if (ptr_ == end_)
+            this->_grow();
+        _ptr_t row = ptr_;
+        ptr_ += row_size_;
+        return row;
+    }
+
+    template<typename InputIter>
+    void push_row(InputIter first)
+    {
+        _ptr_t row = this->emplace_row();
+        if constexpr (std::is_pointer_v<InputIter>)
+            _data_copy_n(first, row_size_, row);
+        else
+            for (size_t i = 0; i < row_size_; ++i, ++first)
+                row[i] = _mtype_cast<value_type>(*first);
+    }
+
+    [[nodiscard]] tensor<value_type, _rank> finish(memory_type access = memory_type::result) &&
+    {
+        const size_t rows = this->size();
+        _dims_t dims;
+        dims[0] = rows;
+        std::copy(row_dims_.begin(), row_dims_.end(), dims.begin() + 1);
+
+        if (chunks_.size() == 1 && chunks_[0].dimension(0) == rows && access == memory_type::result)
+        {
+            tensor<value_type, _rank> ret(std::move(chunks_[0]));
+            this->_clear();
+            return ret;
+        }
+
+        tensor<value_type, _rank> ret(dims, uninitialized, access);
+        _ptr_t dest = ret.data();
+        for (size_t i = 0; i < chunks_.size(); ++i)
+        {
+            // free each chunk right after it is copied
+            tensor<value_type, _rank> chunk(std::move(chunks_[i]));
+            const size_t count = (i + 1 == chunks_.size()) ?
+                size_t(ptr_ - chunk.data()) : chunk.size();
+            _data_copy_n(chunk.data(), count, dest);
+            dest += count;
+        }
+        this->_clear();
+        return ret;
+    }
+
+    [[nodiscard]] MTensor get_mtensor() &&
+    {
+        using mtype = typename derive_tensor_data_type<value_type>::convert_type;
+        static_assert(!std::is_same_v<void, mtype>, "invalid data type to convert to MType");
+        if constexpr (std::is_same_v<mtype, value_type>)
+            return std::move(*this).finish(memory_type::result).get_mtensor();
+        else
+            return tensor<mtype, _rank>(std::move(*this).finish(memory_type::owned)).get_mtensor();
+    }
+
+private:
+    void _grow()
+    {
+        const size_t max_rows = std::max(_max_chunk_size / row_size_, size_t(1));
+        const size_t min_rows = std::max(_min_chunk_size / row_size_, size_t(1));
+        size_t rows = 0;
+        if (chunks_.empty())
+            rows = (reserve_rows_ > 0) ? reserve_rows_ : min_rows;
+        else
+        {
+            full_rows_ += chunks_.back().dimension(0);
+            rows = std::clamp(full_rows_, min_rows, max_rows);
+        }
+
+        _dims_t dims;
+        dims[0] = rows;
+        std::copy(row_dims_.begin(), row_dims_.end(), dims.begin() + 1);
+        // only the first chunk may be returned as it is
+        chunks_.emplace_back(dims, uninitialized,
+                             chunks_.empty() ? memory_type::result : memory_type::owned);
+        ptr_ = chunks_.back().data();
+        end_ = ptr_ + chunks_.back().size();
+    }
+
+    void _clear()
+    {
+        chunks_.clear();
+        full_rows_ = 0;
+        ptr_ = nullptr;
+        end_ = nullptr;
+    }
+
+    _row_dims_t row_dims_;
+    size_t row_size_;
+    size_t reserve_rows_;
+    size_t full_rows_ = 0; // rows in all chunks except the last one
+    _ptr_t ptr_ = nullptr;
+    _ptr_t end_ = nullptr;
+    std::vector<tensor<value_type, _rank>> chunks_{};
+};
+
+template<typename T>
+using list_builder = tensor_builder<T, 1>;
+template<typename T>
+using matrix_builder = tensor_builder<T, 2>;
+
+template<typename T>
+struct is_tensor_builder :
+    std::false_type {};
+template<typename T, size_t Rank>
+struct is_tensor_builder<tensor_builder<T, Rank>> :
+    std::true_type {};
+template<typename T>
+constexpr bool is_tensor_builder_v = is_tensor_builder<T>::value;
+
+
+// small tensor with compile-time dimensions and inline storage, e.g.
+// fixed_tensor<double, 3, 3>; element access and arithmetic are fully unrolled
+template<typename T, size_t... Dims>
+struct fixed_tensor
+{
+    using value_type = T;
+    static constexpr size_t _rank = sizeof...(Dims);
+    static constexpr size_t _size = (Dims * ...);
+    using _dims_t = std::array<size_t, _rank>;
+    static_assert(_rank > 0 && _size > 0);
+
+    static constexpr _dims_t _dims{Dims...};
+    static constexpr _dims_t _strides = _row_major_strides<size_t>(_dims);
+
+    [[nodiscard]] static constexpr size_t rank() noexcept { return _rank; }
+    [[nodiscard]] static constexpr size_t size() noexcept { return _size; }
+    [[nodiscard]] static constexpr _dims_t dimensions() noexcept { return _dims; }
+    [[nodiscard]] static constexpr size_t dimension(size_t level) noexcept { return _dims[level]; }
+
+    constexpr T* data() noexcept { return data_.data(); }
+    constexpr const T* data() const noexcept { return data_.data(); }
+    constexpr T* begin() noexcept { return data_.data(); }
+    constexpr T* end() noexcept { return data_.data() + _size; }
+    constexpr const T* begin() const noexcept { return data_.data(); }
+    constexpr const T* end() const noexcept { return data_.data() + _size; }
+
+    constexpr T& operator[](size_t idx) noexcept
+    {
+        WLL_ASSERT(idx < _size); // index out of range
+        return data_[idx];
+    }
+
+    constexpr const T& operator[](size_t idx) const noexcept
+    {
+        WLL_ASSERT(idx < _size); // index out of range
+        return data_[idx];
+    }
+
+    template<typename... Idx>
+    constexpr T& operator()(Idx... idx) noexcept
+    {
+        static_assert(sizeof...(idx) == _rank);
+        return data_[_get_flat_idx(std::make_index_sequence<_rank>{}, idx...)];
+    }
+
+    template<typename... Idx>
+    constexpr const T& operator()(Idx... idx) const noexcept
+    {
+        static_assert(sizeof...(idx) == _rank);
+        return data_[_get_flat_idx(std::make_index_sequence<_rank>{}, idx...)];
+    }
+
+    template<typename... Idx>
+    T& at(Idx... idx)
+    {
+        static_assert(sizeof...(idx) == _rank);
+        _check_range(std::make_index_sequence<_rank>{}, idx...);
+        return (*this)(idx...);
+    }
+
+    template<typename... Idx>
+    const T& at(Idx... idx) const
+    {
+        static_assert(sizeof...(idx) == _rank);
+        _check_range(std::make_index_sequence<_rank>{}, idx...);
+        return (*this)(idx...);
+    }
+
+    constexpr bool operator==(const fixed_tensor& other) const noexcept
+    {
+        return _fold_and(other, std::make_index_sequence<_size>{});
+    }
+
+    constexpr bool operator!=(const fixed_tensor& other) const noexcept
+    {
+        return !((*this) == other);
+    }
+
+    [[nodiscard]] MTensor get_mtensor() const
+    {
+        using mtype = typename derive_tensor_data_type<value_type>::convert_type;
+        constexpr int mtype_v = derive_tensor_data_type<value_type>::convert_type_v;
+        static_assert(!std::is_same_v<void, mtype>, "invalid data type to convert to MType");
+        MTensor ret_tensor = nullptr;
+        int err = global_lib_data->MTensor_new(
+            mtype_v, _rank, reinterpret_cast<mint*>(const_cast<size_t*>(_dims.data())), &ret_tensor);
+        if (err != LIBRARY_NO_ERROR)
+            throw library_error(err, WLL_CURRENT_FUNCTION + "\nMTensor_new() failed.");
+        try
+        {
+            if constexpr (mtype_v == MType_Integer)
+                _data_copy_n(this->data(), _size, global_lib_data->MTensor_getIntegerData(ret_tensor));
+            else if constexpr (mtype_v == MType_Real)
+                _data_copy_n(this->data(), _size, global_lib_data->MTensor_getRealData(ret_tensor));
+            else  // mtype_v == MType_Complex
+                _data_copy_n(this->data(), _size, global_lib_data->MTensor_getComplexData(ret_tensor));
+        }
+        catch (...)
+        {
+            global_lib_data->MTensor_free(ret_tensor);
+            throw;
+        }
+        return ret_tensor;
+    }
+
+    template<typename... Idx, size_t... Is>
+    static constexpr size_t _get_flat_idx(std::index_sequence<Is...>, Idx... idx) noexcept
+    {
+        return ((size_t(_add_if_negative(idx, ptrdiff_t(_dims[Is]))) * _strides[Is]) + ...);
+    }
+
+    template<typename... Idx, size_t... Is>
+    static void _check_range(std::index_sequence<Is...>, Idx... idx)
+    {
+        const bool in_range = (... && (size_t(_add_if_negative(idx, ptrdiff_t(_dims[Is]))) < _dims[Is]));
+        if (!in_range)
+            throw std::out_of_range(WLL_CURRENT_FUNCTION + "\nindex out of range");
+    }
+
+    template<size_t... Is>
+    constexpr bool _fold_and(const fixed_tensor& other, std::index_sequence<Is...>) const noexcept
+    {
+        return (... && (data_[Is] == other.data_[Is]));
+    }
+
+    std::array<T, _size> data_;
+};
+
+template<typename T, size_t N>
+using fixed_list = fixed_tensor<T, N>;
+template<typename T, size_t M, size_t N>
+using fixed_matrix = fixed_tensor<T, M, N>;
+
+template<typename T>
+struct is_fixed_tensor :
+    std::false_type {};
+template<typename T, size_t... Dims>
+struct is_fixed_tensor<fixed_tensor<T, Dims...>> :
+    std::true_type {};
+template<typename T>
+constexpr bool is_fixed_tensor_v = is_fixed_tensor<T>::value;
+
+template<typename Op, typename T, size_t... Dims, size_t... Is>
+constexpr fixed_tensor<T, Dims...> _fixed_apply(Op op, const fixed_tensor<T, Dims...>& a,
+                                                const fixed_tensor<T, Dims...>& b, std::index_sequence<Is...>)
+{
+    return {{T(op(a.data_[Is], b.data_[Is]))...}};
+}
+
+template<typename Op, typename T, size_t... Dims, size_t... Is>
+constexpr fixed_tensor<T, Dims...> _fixed_apply(Op op, const fixed_tensor<T, Dims...>& a,
+                                                std::index_sequence<Is...>)
+{
+    return {{T(op(a.data_[Is]))...}};
+}
+
+#define WLL_DEFINE_FIXED_OPERATOR(name, op)                                                      \
+template<typename T, size_t... Dims>                                                             \
+constexpr fixed_tensor<T, Dims...> operator op(const fixed_tensor<T, Dims...>& a,                \
+                                               const fixed_tensor<T, Dims...>& b)                \
+{                                                                                                \
+    return _fixed_apply(_expr_op_##name{}, a, b, std::make_index_sequence<(Dims * ...)>{});      \
+}                                                                                                \
+template<typename T, size_t... Dims, typename U,                                                 \
+         typename = std::enable_if_t<_is_expr_scalar_v<U>>>                                      \
+constexpr fixed_tensor<T, Dims...> operator op(const fixed_tensor<T, Dims...>& a, const U& b)    \
+{                                                                                                \
+    return _fixed_apply([&b](const T& x) { return x op b; }, a,                                  \
+                        std::make_index_sequence<(Dims * ...)>{});                               \
+}                                                                                                \
+template<typename T, size_t... Dims, typename U,                                                 \
+         typename = std::enable_if_t<_is_expr_scalar_v<U>>>                                      \
+constexpr fixed_tensor<T, Dims...> operator op(const U& a, const fixed_tensor<T, Dims...>& b)    \
+{                                                                                                \
+    return _fixed_apply([&a](const T& x) { return a op x; }, b,                                  \
+                        std::make_index_sequence<(Dims * ...)>{});                               \
+}                                                                                                \
+template<typename T, size_t... Dims, typename Other>                                             \
+constexpr fixed_tensor<T, Dims...>& operator op##=(fixed_tensor<T, Dims...>& a, const Other& b)  \
+{                                                                                                \
+    return a = a op b;                                                                           \
+}
+
+WLL_DEFINE_FIXED_OPERATOR(plus, +)
+WLL_DEFINE_FIXED_OPERATOR(minus, -)
+WLL_DEFINE_FIXED_OPERATOR(multiplies, *)
+WLL_DEFINE_FIXED_OPERATOR(divides, /)
+#undef WLL_DEFINE_FIXED_OPERATOR
+
+template<typename T, size_t... Dims>
+constexpr fixed_tensor<T, Dims...> operator-(const fixed_tensor<T, Dims...>& a)
+{
+    return _fixed_apply(_expr_op_negate{}, a, std::make_index_sequence<(Dims * ...)>{});
+}
+
+template<typename T, size_t N, size_t... Is>
+constexpr T _fixed_dot_impl(const T* a, const T* b, std::index_sequence<Is...>)
+{
+    return ((a[Is] * b[Is]) + ...);
+}
+
+// inner product of vectors
+template<typename T, size_t N>
+constexpr T dot(const fixed_list<T, N>& a, const fixed_list<T, N>& b)
+{
+    return _fixed_dot_impl<T, N>(a.data(), b.data(), std::make_index_sequence<N>{});
+}
+
+// matrix-vector product
+template<typename T, size_t M, size_t N>
+constexpr fixed_list<T, M> dot(const fixed_matrix<T, M, N>& a, const fixed_list<T, N>& b)
+{
+    fixed_list<T, M> ret{};
+    for (size_t i = 0; i < M; ++i)
+        ret.data_[i] = _fixed_dot_impl<T, N>(a.data() + i * N, b.data(), std::make_index_sequence<N>{});
+    return ret;
+}
+
+// matrix-matrix product
+template<typename T, size_t M, size_t K, size_t N>
+constexpr fixed_matrix<T, M, N> dot(const fixed_matrix<T, M, K>& a, const fixed_matrix<T, K, N>& b)
+{
+    fixed_matrix<T, M, N> ret{};
+    for (size_t i = 0; i < M; ++i)
+        for (size_t k = 0; k < K; ++k)
+            for (size_t j = 0; j < N; ++j)
+                ret.data_[i * N + j] += a.data_[i * K + k] * b.data_[k * N + j];
+    return ret;
+}
+
+template<typename T, size_t M, size_t N>
+constexpr fixed_matrix<T, N, M> transpose(const fixed_matrix<T, M, N>& a)
+{
+    fixed_matrix<T, N, M> ret{};
+    for (size_t i = 0; i < M; ++i)
+        for (size_t j = 0; j < N; ++j)
+            ret.data_[j * M + i] = a.data_[i * N + j];
+    return ret;
+}
+
+template<typename T>
+constexpr fixed_list<T, 3> cross(const fixed_list<T, 3>& a, const fixed_list<T, 3>& b)
+{
+    return {{a.data_[1] * b.data_[2] - a.data_[2] * b.data_[1],
+             a.data_[2] * b.data_[0] - a.data_[0] * b.data_[2],
+             a.data_[0] * b.data_[1] - a.data_[1] * b.data_[0]}};
+}
+
+// contiguous rows of a tensor seen as fixed_tensor objects, without copying
+template<typename Fixed>
+class fixed_rows
+{
+public:
+    using value_type = std::remove_const_t<Fixed>;
+    static_assert(sizeof(value_type) == value_type::_size * sizeof(typename value_type::value_type));
+    static_assert(alignof(value_type) == alignof(typename value_type::value_type));
+
+    fixed_rows(Fixed* first, size_t size) noexcept :
+        first_{first}, size_{size} {}
+
+    [[nodiscard]] size_t size() const noexcept { return size_; }
+    [[nodiscard]] Fixed* data() const noexcept { return first_; }
+    [[nodiscard]] Fixed* begin() const noexcept { return first_; }
+    [[nodiscard]] Fixed* end() const noexcept { return first_ + size_; }
+
+    Fixed& operator[](size_t idx) const noexcept
+    {
+        WLL_ASSERT(idx < size_); // index out of range
+        return first_[idx];
     }
 
-    _ptr_t begin() noexcept
-    {
-        WLL_ASSERT(ptr_ != nullptr);
-        return ptr_;
-    }
+private:
+    Fixed* first_;
+    size_t size_;
+};
+
+template<size_t... Dims, typename TensorT>
+auto _as_fixed_rows_impl(TensorT& t)
+{
+    using T = typename std::remove_const_t<TensorT>::value_type;
+    static_assert(TensorT::_rank == sizeof...(Dims) + 1, "row dimensions do not match the rank of the tensor");
+    using fixed_t = std::conditional_t<std::is_const_v<TensorT>,
+        const fixed_tensor<T, Dims...>, fixed_tensor<T, Dims...>>;
+    constexpr std::array<size_t, sizeof...(Dims)> row_dims{Dims...};
+    for (size_t i = 0; i < sizeof...(Dims); ++i)
+        if (t.dimension(i + 1) != row_dims[i])
+            throw library_dimension_error(WLL_CURRENT_FUNCTION + "\nrow dimensions do not match.");
+    return fixed_rows<fixed_t>(reinterpret_cast<fixed_t*>(t.data()), t.dimension(0));
+}
+
+// e.g. as_fixed_rows<3>(points) views an n x 3 matrix as n fixed_list<T, 3>
+template<size_t... Dims, typename T, size_t Rank>
+auto as_fixed_rows(tensor<T, Rank>& t)
+{
+    return _as_fixed_rows_impl<Dims...>(t);
+}
+
+template<size_t... Dims, typename T, size_t Rank>
+auto as_fixed_rows(const tensor<T, Rank>& t)
+{
+    return _as_fixed_rows_impl<Dims...>(t);
+}
+
+// reductions over tensor and any_tensor data; [0, size) is cut into blocks of fixed size and
+// each block into lanes, which the compiler vectorizes, and partial results are combined in
+// index order, so results do not depend on the number of threads
+template<typename T>
+struct _is_dense_array :
+    std::false_type {};
+template<typename T, size_t Rank>
+struct _is_dense_array<tensor<T, Rank>> :
+    std::true_type {};
+template<typename T>
+struct _is_dense_array<any_tensor<T>> :
+    std::true_type {};
+template<typename T>
+constexpr bool _is_dense_array_v = _is_dense_array<T>::value;
+
+constexpr size_t _reduce_block_size = 4096;
+constexpr size_t _reduce_lanes      = 8;
+
+// combine(map(0), map(1), ..., map(count - 1)) for an associative combine
+template<typename Acc, typename Map, typename Combine>
+Acc _reduce(size_t count, const Acc& identity, Map map, Combine combine)
+{
+    auto reduce_block = [&](size_t block)
+    {
+        const size_t first = block * _reduce_block_size;
+        const size_t last  = std::min(first + _reduce_block_size, count);
+        std::array<Acc, _reduce_lanes> acc;
+        acc.fill(identity);
+        size_t i = first;
+        for (; i + _reduce_lanes <= last; i += _reduce_lanes)
+            for (size_t lane = 0; lane < _reduce_lanes; ++lane)
+                acc[lane] = combine(acc[lane], map(i + lane));
+        for (size_t lane = 0; i < last; ++i, ++lane)
+            acc[lane] = combine(acc[lane], map(i));
+        for (size_t width = _reduce_lanes / 2; width > 0; width /= 2)
+            for (size_t lane = 0; lane < width; ++lane)
+                acc[lane] = combine(acc[lane], acc[lane + width]);
+        return acc[0];
+    };
+
+    const size_t num_blocks = (count + _reduce_block_size - 1) / _reduce_block_size;
+    if (num_blocks == 0)
+        return identity;
+    if (num_blocks == 1)
+        return reduce_block(0);
+    std::vector<Acc> partials(num_blocks, identity);
+    parallel_for(0, num_blocks, [&](size_t first, size_t last)
+    {
+        for (size_t block = first; block < last; ++block)
+            partials[block] = reduce_block(block);
+    });
+    Acc ret = partials[0];
+    for (size_t block = 1; block < num_blocks; ++block)
+        ret = combine(ret, partials[block]);
+    return ret;
+}
+
+template<typename Array>
+void _check_not_empty(const Array& a)
+{
+    if (a.size() == 0)
+        throw library_dimension_error(WLL_CURRENT_FUNCTION + "\ncannot reduce an empty tensor.");
+}
+
+template<typename Array, typename = std::enable_if_t<_is_dense_array_v<Array>>>
+typename Array::value_type sum(const Array& a)
+{
+    using value_type = typename Array::value_type;
+    const value_type* ptr = a.data();
+    return _reduce(a.size(), value_type{}, [=](size_t i) { return ptr[i]; },
+                   [](const value_type& x, const value_type& y) { return x + y; });
+}
+
+template<typename Array, typename = std::enable_if_t<_is_dense_array_v<Array>>>
+typename Array::value_type min(const Array& a)
+{
+    using value_type = typename Array::value_type;
+    static_assert(!is_std_complex_v<value_type>, "complex numbers are not ordered");
+    _check_not_empty(a);
+    const value_type* ptr = a.data();
+    return _reduce(a.size(), ptr[0], [=](size_t i) { return ptr[i]; },
+                   [](const value_type& x, const value_type& y) { return y < x ? y : x; });
+}
 
-    _ptr_t end() noexcept
-    {
-        return this->begin() + size_;
-    }
+template<typename Array, typename = std::enable_if_t<_is_dense_array_v<Array>>>
+typename Array::value_type max(const Array& a)
+{
+    using value_type = typename Array::value_type;
+    static_assert(!is_std_complex_v<value_type>, "complex numbers are not ordered");
+    _check_not_empty(a);
+    const value_type* ptr = a.data();
+    return _reduce(a.size(), ptr[0], [=](size_t i) { return ptr[i]; },
+                   [](const value_type& x, const value_type& y) { return x < y ? y : x; });
+}
 
-    [[nodiscard]] MTensor get_mtensor() const &
-    {
-        return _get_mtensor_lvalue();
-    }
+template<typename T>
+struct _arg_extremum
+{
+    T      value_;
+    size_t index_;
+};
 
-    MTensor get_mtensor() &&
+// flat index of the first smallest element
+template<typename Array, typename = std::enable_if_t<_is_dense_array_v<Array>>>
+size_t argmin(const Array& a)
+{
+    using value_type = typename Array::value_type;
+    static_assert(!is_std_complex_v<value_type>, "complex numbers are not ordered");
+    _check_not_empty(a);
+    const value_type* ptr = a.data();
+    using acc_t = _arg_extremum<value_type>;
+    return _reduce(a.size(), acc_t{ptr[0], 0}, [=](size_t i) { return acc_t{ptr[i], i}; },
+        [](const acc_t& x, const acc_t& y)
+        {
+            return (y.value_ < x.value_ || (!(x.value_ < y.value_) && y.index_ < x.index_)) ? y : x;
+        }).index_;
+}
+
+// flat index of the first largest element
+template<typename Array, typename = std::enable_if_t<_is_dense_array_v<Array>>>
+size_t argmax(const Array& a)
+{
+    using value_type = typename Array::value_type;
+    static_assert(!is_std_complex_v<value_type>, "complex numbers are not ordered");
+    _check_not_empty(a);
+    const value_type* ptr = a.data();
+    using acc_t = _arg_extremum<value_type>;
+    return _reduce(a.size(), acc_t{ptr[0], 0}, [=](size_t i) { return acc_t{ptr[i], i}; },
+        [](const acc_t& x, const acc_t& y)
+        {
+            return (x.value_ < y.value_ || (!(y.value_ < x.value_) && y.index_ < x.index_)) ? y : x;
+        }).index_;
+}
+
+// sum of the element-wise products of arrays of the same dimensions, without conjugation
+template<typename ArrayA, typename ArrayB,
+         typename = std::enable_if_t<_is_dense_array_v<ArrayA> && _is_dense_array_v<ArrayB>>>
+auto dot(const ArrayA& a, const ArrayB& b)
+{
+    using value_type = decltype(std::declval<typename ArrayA::value_type>() *
+                                std::declval<typename ArrayB::value_type>());
+    const auto& dims_a = a.dimensions();
+    const auto& dims_b = b.dimensions();
+    if (!std::equal(dims_a.begin(), dims_a.end(), dims_b.begin(), dims_b.end()))
+        throw library_dimension_error(WLL_CURRENT_FUNCTION + "\ntensors have different dimensions.");
+    const auto* ptr_a = a.data();
+    const auto* ptr_b = b.data();
+    return _reduce(a.size(), value_type{}, [=](size_t i) { return value_type(ptr_a[i] * ptr_b[i]); },
+                   [](const value_type& x, const value_type& y) { return x + y; });
+}
+
+// 2-norm of the flattened array, computed in double for integers
+template<typename Array, typename = std::enable_if_t<_is_dense_array_v<Array>>>
+auto norm(const Array& a)
+{
+    using value_type = typename Array::value_type;
+    using real_t = std::conditional_t<is_std_complex_v<value_type>, complex_value_t<value_type>,
+                   std::conditional_t<std::is_integral_v<value_type>, double, value_type>>;
+    const value_type* ptr = a.data();
+    const real_t sum_of_squares = _reduce(a.size(), real_t{},
+        [=](size_t i)
+        {
+            if constexpr (is_std_complex_v<value_type>)
+                return std::norm(ptr[i]);
+            else
+                return real_t(ptr[i]) * real_t(ptr[i]);
+        },
+        [](const real_t& x, const real_t& y) { return x + y; });
+    return std::sqrt(sum_of_squares);
+}
+
+// rows of the reduced level that one task combines; it depends on the shape only, so
+// results are the same for any number of threads
+constexpr size_t _reduce_level_min_rows = 64;
+
+inline size_t _reduce_level_rows(size_t inner) noexcept
+{
+    return std::max(_reduce_level_min_rows, _reduce_block_size / std::min(inner, _reduce_block_size));
+}
+
+// reduce a tensor along dimension Level; the level is cut into blocks of rows, each block is
+// combined in order of the index on that level, and the partials of the blocks are combined
+// in block order. the loop over the dimensions after Level is innermost, so it is contiguous
+// and vectorized
+template<size_t Level, typename T, size_t Rank, typename Combine>
+tensor<T, Rank - 1> _reduce_level(const tensor<T, Rank>& a, Combine combine, const T* identity)
+{
+    static_assert(Rank > 1, "use the full reduction for lists");
+    static_assert(Level < Rank, "level out of range");
+    const auto dims = a.dimensions();
+    std::array<size_t, Rank - 1> ret_dims;
+    std::copy_n(dims.begin(), Level, ret_dims.begin());
+    std::copy(dims.begin() + Level + 1, dims.end(), ret_dims.begin() + Level);
+
+    size_t outer = 1;
+    for (size_t level = 0; level < Level; ++level)
+        outer *= dims[level];
+    const size_t count = dims[Level];
+    const size_t inner = a.stride(Level);
+    tensor<T, Rank - 1> ret(ret_dims, uninitialized);
+    if (ret.size() == 0)
+        return ret;
+    if (count == 0)
     {
-        return _get_mtensor_rvalue();
+        if (identity == nullptr)
+            throw library_dimension_error(WLL_CURRENT_FUNCTION + "\ncannot reduce an empty level.");
+        std::fill(ret.begin(), ret.end(), *identity);
+        return ret;
     }
 
-    template<typename InputIter>
-    void copy_data_from(InputIter src, size_t count = size_t(-1))
+    // tasks are (block of rows, outer index, block of inner indices) triples; block 0 is
+    // reduced into ret, and block b > 0 into the partial at (b - 1) * ret_size
+    const size_t ret_size     = outer * inner;
+    const size_t rows         = _reduce_level_rows(inner);
+    const size_t row_blocks   = (count + rows - 1) / rows;
+    const size_t inner_blocks = (inner + _reduce_block_size - 1) / _reduce_block_size;
+    std::vector<T> partials((row_blocks - 1) * ret_size);
+    const T* src  = a.data();
+    T*       dest = ret.data();
+    parallel_for(0, row_blocks * outer * inner_blocks, [&](size_t first, size_t last)
     {
-        if (count == size_t(-1))
-            count = size_;
-        WLL_ASSERT(count == size_);
-        if (count > 0)
+        for (size_t task = first; task < last; ++task)
         {
-            _ptr_t dest = this->ptr_;
-            for (size_t i = 0; i < count; ++i, ++src, ++dest)
-                *dest = _mtype_cast<value_type>(*src);
+            const size_t block   = task / (outer * inner_blocks);
+            const size_t o       = task / inner_blocks % outer;
+            const size_t begin   = (task % inner_blocks) * _reduce_block_size;
+            const size_t end     = std::min(begin + _reduce_block_size, inner);
+            const size_t k_first = block * rows;
+            const size_t k_last  = std::min(k_first + rows, count);
+            T*       dest_ptr = (block == 0 ? dest : partials.data() + (block - 1) * ret_size) + o * inner;
+            const T* src_ptr  = src + (o * count + k_first) * inner;
+            std::copy(src_ptr + begin, src_ptr + end, dest_ptr + begin);
+            for (size_t k = k_first + 1; k < k_last; ++k)
+            {
+                src_ptr += inner;
+                for (size_t i = begin; i < end; ++i)
+                    dest_ptr[i] = combine(dest_ptr[i], src_ptr[i]);
+            }
         }
-    }
-
-    template<typename OutputIter>
-    void copy_data_to(OutputIter dest, size_t count = size_t(-1))
+    });
+    if (row_blocks > 1)
     {
-        if (count == size_t(-1))
-            count = size_;
-        WLL_ASSERT(count == size_);
-        if (count > 0)
+        parallel_for(0, ret_size, [&](size_t first, size_t last)
         {
-            _ptr_t src = this->ptr_;
-            for (size_t i = 0; i < count; ++i, ++src, ++dest)
-                *dest = _mtype_cast<decltype(*dest)>(*src);
-        }
-
+            for (size_t block = 1; block < row_blocks; ++block)
+            {
+                const T* part = partials.data() + (block - 1) * ret_size;
+                for (size_t i = first; i < last; ++i)
+                    dest[i] = combine(dest[i], part[i]);
+            }
+        });
     }
+    return ret;
+}
 
-    template<size_t Level = _rank - 1, typename IdxTuple>
-    size_t _get_flat_idx(const IdxTuple& idx_tuple) const
-    {
-        auto plain_idx = std::get<Level>(idx_tuple);
-        using plain_type = decltype(plain_idx);
-        static_assert(std::is_integral_v<plain_type>, "index must be of an integral type");
+// e.g. sum<0>(m) adds up the rows of a matrix, and sum<1>(m) the columns
+template<size_t Level, typename T, size_t Rank>
+tensor<T, Rank - 1> sum(const tensor<T, Rank>& a)
+{
+    const T zero{};
+    return _reduce_level<Level>(a, [](const T& x, const T& y) { return x + y; }, &zero);
+}
 
-        size_t unsigned_idx = size_t(plain_idx);
-        if constexpr (std::is_signed_v<plain_type>)
-            if (plain_idx < plain_type(0))
-                unsigned_idx += dims_[Level];
-        if (unsigned_idx >= dims_[Level])
-            throw std::out_of_range(WLL_CURRENT_FUNCTION + "\nindex out of range");
-        if constexpr (Level == 0)
-            return unsigned_idx;
-        else
-            return _get_flat_idx<Level - 1>(idx_tuple) * dims_[Level] + unsigned_idx;
-    }
+template<size_t Level, typename T, size_t Rank>
+tensor<T, Rank - 1> min(const tensor<T, Rank>& a)
+{
+    static_assert(!is_std_complex_v<T>, "complex numbers are not ordered");
+    return _reduce_level<Level>(a, [](const T& x, const T& y) { return y < x ? y : x; },
+                                static_cast<const T*>(nullptr));
+}
 
-    template<size_t Level = _rank - 1, typename IdxTuple>
-    size_t _get_flat_idx_unsafe(const IdxTuple& idx_tuple) const noexcept
+template<size_t Level, typename T, size_t Rank>
+tensor<T, Rank - 1> max(const tensor<T, Rank>& a)
+{
+    static_assert(!is_std_complex_v<T>, "complex numbers are not ordered");
+    return _reduce_level<Level>(a, [](const T& x, const T& y) { return x < y ? y : x; },
+                                static_cast<const T*>(nullptr));
+}
+
+// sorting; integers are radix sorted, other types merge sorted, both stable and in parallel
+constexpr size_t _sort_chunk_size = size_t(1) << 14; // smallest part sorted by one thread
+
+template<typename T>
+constexpr bool _is_radix_sortable_v = std::is_integral_v<T> && !std::is_same_v<T, bool>;
+
+// the number of parts that parallel sorts cut count elements into
+inline size_t _sort_num_chunks(size_t count)
+{
+    if (count < 2 * _sort_chunk_size)
+        return 1;
+    return std::min(get_thread_pool().size(), count / _sort_chunk_size);
+}
+
+inline size_t _chunk_begin(size_t count, size_t num_chunks, size_t chunk) noexcept
+{
+    return count * chunk / num_chunks;
+}
+
+// call fn(chunk, first, last) for each part of [0, count) in parallel
+template<typename Fn>
+void _for_each_chunk(size_t count, size_t num_chunks, Fn fn)
+{
+    parallel_for(0, num_chunks, [&](size_t first, size_t last)
     {
-        auto plain_idx = std::get<Level>(idx_tuple);
-        using plain_type = decltype(plain_idx);
-        static_assert(std::is_integral_v<plain_type>, "index must be of an integral type");
+        for (size_t chunk = first; chunk < last; ++chunk)
+            fn(chunk, _chunk_begin(count, num_chunks, chunk), _chunk_begin(count, num_chunks, chunk + 1));
+    }, 1);
+}
 
-        size_t unsigned_idx = size_t(plain_idx);
-        if constexpr (std::is_signed_v<plain_type>)
-            if (plain_idx < plain_type(0))
-                unsigned_idx += dims_[Level];
-        WLL_ASSERT(unsigned_idx < dims_[Level]);
-        if constexpr (Level == 0)
-            return unsigned_idx;
+template<typename T>
+void _parallel_copy(const T* src, size_t count, T* dest)
+{
+    parallel_for(0, count, [=](size_t first, size_t last)
+    {
+        std::copy(src + first, src + last, dest + first);
+    });
+}
+
+// number of elements of a among the first k elements of the stable merge of a and b
+template<typename T, typename Comp>
+size_t _merge_co_rank(size_t k, const T* a, size_t size_a, const T* b, size_t size_b, Comp& comp)
+{
+    size_t lo = k > size_b ? k - size_b : 0;
+    size_t hi = std::min(k, size_a);
+    while (lo < hi)
+    {
+        const size_t i = lo + (hi - lo) / 2;
+        if (comp(b[k - i - 1], a[i]))
+            hi = i;
         else
-            return _get_flat_idx_unsafe<Level - 1>(idx_tuple) * dims_[Level] + unsigned_idx;
+            lo = i + 1;
     }
+    return lo;
+}
 
-    template<typename IdxTuple, size_t... Is>
-    value_type& _tuple_at_impl(const IdxTuple& idx_tuple, std::index_sequence<Is...>)
+// std::stable_sort on parts, then rounds of merges of pairs of runs; each merge is cut
+// into segments of the output that are merged independently
+template<typename T, typename Comp>
+void _parallel_stable_sort(T* data, size_t count, Comp comp)
+{
+    const size_t num_chunks = _sort_num_chunks(count);
+    if (num_chunks == 1)
     {
-        return this->operator()(std::get<Is>(idx_tuple)...);
+        std::stable_sort(data, data + count, comp);
+        return;
     }
+    _for_each_chunk(count, num_chunks, [&](size_t, size_t first, size_t last)
+    {
+        std::stable_sort(data + first, data + last, comp);
+    });
 
-    template<typename IdxTuple, size_t... Is>
-    value_type _tuple_at_impl(const IdxTuple& idx_tuple, std::index_sequence<Is...>) const
+    struct _merge_task
     {
-        return this->operator()(std::get<Is>(idx_tuple)...);
+        size_t first_, mid_, last_;  // runs [first, mid) and [mid, last)
+        size_t out_first_, out_last_;
+    };
+    const size_t segment = (count - 1) / num_chunks + 1;
+    _owned_vector<T> buffer(count);
+    T* src  = data;
+    T* dest = buffer.data();
+    std::vector<_merge_task> tasks;
+    for (size_t width = 1; width < num_chunks; width *= 2)
+    {
+        tasks.clear();
+        for (size_t chunk = 0; chunk < num_chunks; chunk += 2 * width)
+        {
+            const size_t first = _chunk_begin(count, num_chunks, chunk);
+            const size_t mid   = _chunk_begin(count, num_chunks, std::min(chunk + width, num_chunks));
+            const size_t last  = _chunk_begin(count, num_chunks, std::min(chunk + 2 * width, num_chunks));
+            for (size_t k = first; k < last; k += segment)
+                tasks.push_back({first, mid, last, k, std::min(k + segment, last)});
+        }
+        parallel_for(0, tasks.size(), [&](size_t first, size_t last)
+        {
+            for (size_t t = first; t < last; ++t)
+            {
+                const _merge_task& task = tasks[t];
+                const T*     a      = src + task.first_;
+                const T*     b      = src + task.mid_;
+                const size_t size_a = task.mid_ - task.first_;
+                const size_t size_b = task.last_ - task.mid_;
+                const size_t k0 = task.out_first_ - task.first_;
+                const size_t k1 = task.out_last_ - task.first_;
+                const size_t i0 = _merge_co_rank(k0, a, size_a, b, size_b, comp);
+                const size_t i1 = _merge_co_rank(k1, a, size_a, b, size_b, comp);
+                std::merge(a + i0, a + i1, b + (k0 - i0), b + (k1 - i1), dest + task.out_first_, comp);
+            }
+        }, 1);
+        std::swap(src, dest);
     }
+    if (src != data)
+        _parallel_copy(src, count, data);
+}
 
-private:
+// integer mapped to an unsigned key with the same order
+template<typename T>
+auto _radix_key(T value) noexcept
+{
+    using key_t = std::make_unsigned_t<T>;
+    key_t key = static_cast<key_t>(value);
+    if constexpr (std::is_signed_v<T>)
+        key ^= key_t(key_t(1) << (8 * sizeof(T) - 1));
+    return key;
+}
 
-    template<size_t I = 0, typename Dims>
-    bool _has_same_dims(const Dims* other_dims)
+// stable LSD radix sort by the bytes of key(element); each thread counts and scatters its
+// own part, and bytes that are the same for all elements are skipped
+template<typename E, typename Key>
+void _radix_sort(E* data, size_t count, Key key)
+{
+    using key_t = decltype(key(*data));
+    constexpr size_t radix = 256;
+    if (count < 1024)
     {
-        if constexpr (I + 1 == _rank)
-            return (this->dims_[I] == size_t(other_dims[I])) && _has_same_dims<I + 1, Dims>(other_dims);
-        else
-            return this->dims_[_rank - 1] == size_t(other_dims[_rank - 1]);
+        std::stable_sort(data, data + count, [&](const E& x, const E& y) { return key(x) < key(y); });
+        return;
     }
 
-    void _destroy()
+    const size_t num_chunks = _sort_num_chunks(count);
+    std::vector<std::array<size_t, radix>> offsets(num_chunks);
+    _owned_vector<E> buffer(count);
+    E* src  = data;
+    E* dest = buffer.data();
+    for (size_t shift = 0; shift < 8 * sizeof(key_t); shift += 8)
     {
-        if (access_ == memory_type::empty)
-        {
-            WLL_ASSERT(mtensor_ == nullptr);
-            WLL_ASSERT(ptr_ == nullptr);
-        }
-        else if (access_ == memory_type::owned)
-        {
-            WLL_ASSERT(mtensor_ == nullptr);
-            free(ptr_);
-        }
-        else if (access_ == memory_type::proxy)
+        auto digit = [&](const E& e) { return size_t((key(e) >> shift) & (radix - 1)); };
+        _for_each_chunk(count, num_chunks, [&](size_t chunk, size_t first, size_t last)
         {
-            // do nothing
-        }
-        else if (access_ == memory_type::manual)
+            auto& chunk_counts = offsets[chunk];
+            chunk_counts.fill(0);
+            for (size_t i = first; i < last; ++i)
+                ++chunk_counts[digit(src[i])];
+        });
+
+        // offsets in (digit, chunk) order keep equal digits in their original order
+        bool is_trivial = false;
+        size_t offset = 0;
+        for (size_t d = 0; d < radix && !is_trivial; ++d)
         {
-            global_lib_data->MTensor_free(mtensor_);
+            size_t total = 0;
+            for (size_t chunk = 0; chunk < num_chunks; ++chunk)
+            {
+                const size_t chunk_count = offsets[chunk][d];
+                offsets[chunk][d] = offset + total;
+                total += chunk_count;
+            }
+            offset += total;
+            is_trivial = (total == count);
         }
-        else if (access_ == memory_type::shared)
+        if (is_trivial)
+            continue;
+
+        _for_each_chunk(count, num_chunks, [&](size_t chunk, size_t first, size_t last)
         {
-            global_lib_data->MTensor_disown(mtensor_);
-        }
-        ptr_     = nullptr;
-        mtensor_ = nullptr;
-        access_  = memory_type::empty;
-    }
+            auto& chunk_offsets = offsets[chunk];
+            for (size_t i = first; i < last; ++i)
+                dest[chunk_offsets[digit(src[i])]++] = src[i];
+        });
+        std::swap(src, dest);
+    }
+    if (src != data)
+        _parallel_copy(src, count, data);
+}
 
-    void _release_ownership()
+inline void _iota_indices(list<mint>& indices)
+{
+    mint* ptr = indices.data();
+    parallel_for(0, indices.size(), [=](size_t first, size_t last)
     {
-        // destruct the object without free resource, manual tensor only
-        WLL_ASSERT(access_ == memory_type::manual);
-        ptr_     = nullptr;
-        mtensor_ = nullptr;
-        access_  = memory_type::empty;
-    }
+        for (size_t i = first; i < last; ++i)
+            ptr[i] = mint(i);
+    });
+}
 
-    [[nodiscard]] MTensor _get_mtensor_lvalue() const
+inline void _to_one_based(list<mint>& indices)
+{
+    mint* ptr = indices.data();
+    parallel_for(0, indices.size(), [=](size_t first, size_t last)
     {
-        WLL_ASSERT(access_ != memory_type::empty);
-
-        using mtype = typename derive_tensor_data_type<value_type>::convert_type;
-        constexpr int mtype_v = derive_tensor_data_type<value_type>::convert_type_v;
-        static_assert(!std::is_same_v<void, mtype>, "invalid data type to convert to MType");
+        for (size_t i = first; i < last; ++i)
+            ++ptr[i];
+    });
+}
 
-        MTensor ret_tensor = nullptr;
-        int err = global_lib_data->MTensor_new(
-            mtype_v, _rank, reinterpret_cast<mint*>(const_cast<size_t*>(dims_.data())), &ret_tensor);
-        if (err != LIBRARY_NO_ERROR)
-            throw library_error(err, WLL_CURRENT_FUNCTION + "\nMTensor_new() failed.");
-        if constexpr (mtype_v == MType_Integer)
-            _data_copy_n(ptr_, size_, global_lib_data->MTensor_getIntegerData(ret_tensor));
-        else if constexpr (mtype_v == MType_Real)
-            _data_copy_n(ptr_, size_, global_lib_data->MTensor_getRealData(ret_tensor));
-        else  // mtype_v == MType_Complex
-            _data_copy_n(ptr_, size_, global_lib_data->MTensor_getComplexData(ret_tensor));
-        return ret_tensor;
-    }
+// sort in place, NaN is not supported
+template<typename T>
+void sort(list<T>& a)
+{
+    static_assert(!is_std_complex_v<T>, "complex numbers are not ordered");
+    if constexpr (_is_radix_sortable_v<T>)
+        _radix_sort(a.data(), a.size(), [](const T& x) { return _radix_key(x); });
+    else
+        _parallel_stable_sort(a.data(), a.size(), [](const T& x, const T& y) { return x < y; });
+}
 
-    MTensor _get_mtensor_rvalue()
+// stable ordering permutation, 1-based so that a[[argsort(a)]] is sorted in the kernel
+template<typename T>
+list<mint> argsort(const list<T>& a)
+{
+    static_assert(!is_std_complex_v<T>, "complex numbers are not ordered");
+    const size_t count = a.size();
+    const T* ptr = a.data();
+    list<mint> ret({count}, uninitialized);
+    if constexpr (_is_radix_sortable_v<T>)
     {
-        WLL_ASSERT(access_ != memory_type::empty);
-        if (access_ == memory_type::manual)
+        struct _keyed
         {
-            // return the containing mtensor and destroy *this
-            MTensor ret = this->mtensor_;
-            this->_release_ownership();
-            return ret;
-        }
-        else // access == owned / proxy / shared
+            T    key_;
+            mint index_;
+        };
+        _owned_vector<_keyed> keyed(count);
+        parallel_for(0, count, [&](size_t first, size_t last)
         {
-            // return a copy
-            return _get_mtensor_lvalue();
-        }
+            for (size_t i = first; i < last; ++i)
+                keyed[i] = {ptr[i], mint(i)};
+        });
+        _radix_sort(keyed.data(), count, [](const _keyed& e) { return _radix_key(e.key_); });
+        mint* ret_ptr = ret.data();
+        parallel_for(0, count, [&](size_t first, size_t last)
+        {
+            for (size_t i = first; i < last; ++i)
+                ret_ptr[i] = keyed[i].index_;
+        });
     }
-
-    template<typename Other>
-    void _swap_pointers(Other&& other)
+    else
     {
-        WLL_ASSERT(this->access_ == memory_type::owned ||
-                   this->access_ == memory_type::manual); // only tensors own data can swap
-        WLL_ASSERT(other.access_ == memory_type::owned ||
-                   other.access_ == memory_type::manual);
-        if (!(this->_has_same_dims(other.dims_.data())))
-            throw library_dimension_error(WLL_CURRENT_FUNCTION + "\ntensors have different dimensions.");
-        std::swap(this->ptr_, other.ptr_);
-        std::swap(this->mtensor_, other.mtensor_);
-        std::swap(this->access_, other.access_);
+        _iota_indices(ret);
+        _parallel_stable_sort(ret.data(), count, [ptr](mint i, mint j) { return ptr[i] < ptr[j]; });
     }
+    _to_one_based(ret);
+    return ret;
+}
 
-    template<size_t Level, typename Data>
-    static auto _get_init_data_dims_impl(_dims_t& dims, const Data& data) noexcept
-        -> std::enable_if_t<Level + 1 != _rank>
-    {
-        const size_t size = data.size();
-        WLL_ASSERT(size > 0);
-        if (dims[Level] == size_t(0))
-            dims[Level] = size;
-        else
-            WLL_ASSERT(dims[Level] == size); // shape of the array should be regular
+// stable ordering permutation of the rows of a matrix in lexicographic order, 1-based
+template<typename T>
+list<mint> argsort_rows(const matrix<T>& a)
+{
+    static_assert(!is_std_complex_v<T>, "complex numbers are not ordered");
+    const size_t rows = a.dimension(0);
+    const size_t cols = a.dimension(1);
+    const T* ptr = a.data();
+    list<mint> ret({rows}, uninitialized);
+    _iota_indices(ret);
+    _parallel_stable_sort(ret.data(), rows, [=](mint i, mint j)
+    {
+        return std::lexicographical_compare(ptr + i * cols, ptr + (i + 1) * cols,
+                                            ptr + j * cols, ptr + (j + 1) * cols);
+    });
+    _to_one_based(ret);
+    return ret;
+}
 
-        for (const auto& sub_data : data)
-            _get_init_data_dims_impl<Level + 1>(dims, sub_data);
-    }
+// sort the rows of a matrix in place in lexicographic order
+template<typename T>
+void sort_rows(matrix<T>& a)
+{
+    const list<mint> order = argsort_rows(a);
+    const size_t cols = a.dimension(1);
+    matrix<T> sorted(a.dimensions(), uninitialized, memory_type::owned);
+    const T* src  = a.data();
+    T*       dest = sorted.data();
+    parallel_for_rows(a, [&](size_t first, size_t last)
+    {
+        for (size_t row = first; row < last; ++row)
+            std::copy_n(src + (order[row] - 1) * cols, cols, dest + row * cols);
+    });
+    a.copy_data_from(sorted.data());
+}
 
-    template<size_t Level, typename Data>
-    static auto _get_init_data_dims_impl(_dims_t& dims, const Data& data) noexcept
-        -> std::enable_if_t<Level + 1 == _rank>
-    {
-        const size_t size = data.size();
-        WLL_ASSERT(size > 0);
-        if (dims[Level] == size_t(0))
-            dims[Level] = size;
-        else
-            WLL_ASSERT(dims[Level] == size); // shape of the array should be regular
+// positions in [0, count) where a run of elements that are equal(i - 1, i) begins, followed
+// by count; each thread scans its own part, comparing its first element with the last one of
+// the part before, and the starts of the parts are placed in part order
+template<typename Equal>
+_owned_vector<size_t> _run_starts(size_t count, Equal equal)
+{
+    auto is_start = [&](size_t i) { return i == 0 || !equal(i - 1, i); };
+    const size_t num_chunks = _sort_num_chunks(count);
+    std::vector<size_t> offsets(num_chunks + 1, 0);
+    _for_each_chunk(count, num_chunks, [&](size_t chunk, size_t first, size_t last)
+    {
+        size_t chunk_count = 0;
+        for (size_t i = first; i < last; ++i)
+            chunk_count += size_t(is_start(i));
+        offsets[chunk + 1] = chunk_count;
+    });
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+    _owned_vector<size_t> starts(offsets[num_chunks] + 1);
+    _for_each_chunk(count, num_chunks, [&](size_t chunk, size_t first, size_t last)
+    {
+        size_t pos = offsets[chunk];
+        for (size_t i = first; i < last; ++i)
+            if (is_start(i))
+                starts[pos++] = i;
+    });
+    starts.back() = count;
+    return starts;
+}
+
+// sorted distinct elements, as Union
+template<typename T>
+list<T> unique(const list<T>& a)
+{
+    list<T> sorted = a.clone(memory_type::owned);
+    sort(sorted);
+    const T* ptr = sorted.data();
+    const auto starts = _run_starts(sorted.size(), [ptr](size_t i, size_t j) { return ptr[i] == ptr[j]; });
+    list<T> ret({starts.size() - 1}, uninitialized);
+    T* ret_ptr = ret.data();
+    parallel_for(0, ret.size(), [&](size_t first, size_t last)
+    {
+        for (size_t g = first; g < last; ++g)
+            ret_ptr[g] = ptr[starts[g]];
+    });
+    return ret;
+}
+
+// distinct elements in order of first occurrence and the number of times each occurs, as Tally
+template<typename T>
+std::pair<list<T>, list<mint>> tally(const list<T>& a)
+{
+    // equal elements are adjacent in the stable order, led by their first occurrence
+    const list<mint> order = argsort(a);
+    const T*    ptr       = a.data();
+    const mint* order_ptr = order.data();
+    const auto starts = _run_starts(order.size(), [=](size_t i, size_t j)
+    {
+        return ptr[order_ptr[i] - 1] == ptr[order_ptr[j] - 1];
+    });
+    struct _group
+    {
+        mint first_;
+        mint count_;
+    };
+    const size_t num_groups = starts.size() - 1;
+    _owned_vector<_group> groups(num_groups);
+    parallel_for(0, num_groups, [&](size_t first, size_t last)
+    {
+        for (size_t g = first; g < last; ++g)
+            groups[g] = {order_ptr[starts[g]] - 1, mint(starts[g + 1] - starts[g])};
+    });
+    _radix_sort(groups.data(), num_groups, [](const _group& g) { return _radix_key(g.first_); });
+
+    list<T>    values({num_groups}, uninitialized);
+    list<mint> counts({num_groups}, uninitialized);
+    T*    values_ptr = values.data();
+    mint* counts_ptr = counts.data();
+    parallel_for(0, num_groups, [&](size_t first, size_t last)
+    {
+        for (size_t g = first; g < last; ++g)
+        {
+            values_ptr[g] = ptr[groups[g].first_];
+            counts_ptr[g] = groups[g].count_;
+        }
+    });
+    return {std::move(values), std::move(counts)};
+}
+
+// Part-style indexing with lists of 1-based indices, negative indices count from the end
+inline void _check_part_indices(const list<mint>& indices, size_t length)
+{
+    const mint* ptr = indices.data();
+    const mint  n   = mint(length);
+    std::atomic<bool> is_valid{true};
+    parallel_for(0, indices.size(), [&](size_t first, size_t last)
+    {
+        bool chunk_bad = false;
+        for (size_t i = first; i < last; ++i)
+            chunk_bad |= (ptr[i] == 0) | (ptr[i] > n) | (ptr[i] < -n);
+        if (chunk_bad)
+            is_valid.store(false, std::memory_order_relaxed);
+    });
+    if (is_valid.load(std::memory_order_relaxed))
+        return;
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        if (ptr[i] == 0 || ptr[i] > n || ptr[i] < -n)
+        {
+            std::ostringstream msg;
+            msg << WLL_CURRENT_FUNCTION << "\npart " << ptr[i] << " at position " << i + 1
+                << " out of range for length " << length;
+            throw std::out_of_range(msg.str());
+        }
     }
+}
+
+// 0-based offset of a checked part index
+inline size_t _part_offset(mint idx, mint length) noexcept
+{
+    return size_t(idx < 0 ? idx + length : idx - 1);
+}
+
+// a[[indices]]
+template<typename T>
+list<T> take(const list<T>& a, const list<mint>& indices)
+{
+    _check_part_indices(indices, a.size());
+    const size_t count  = indices.size();
+    const mint   length = mint(a.size());
+    const T*     src    = a.data();
+    const mint*  idx    = indices.data();
+    list<T> ret({count}, uninitialized);
+    T* dest = ret.data();
+    parallel_for(0, count, [=](size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; ++i)
+            dest[i] = src[_part_offset(idx[i], length)];
+    });
+    return ret;
+}
 
-    static _dims_t _get_init_data_dims(const _init_data_t& data) noexcept
-    {
-        _dims_t dims ={};
-        _get_init_data_dims_impl<0>(dims, data);
-        return dims;
-    }
+// a[[indices]] for a tensor of any rank, i.e. whole rows along the first dimension
+template<typename T, size_t Rank>
+tensor<T, Rank> take_rows(const tensor<T, Rank>& a, const list<mint>& indices)
+{
+    static_assert(Rank >= 1, "rank must be at least 1");
+    const size_t rows = a.dimension(0);
+    _check_part_indices(indices, rows);
+    auto dims = a.dimensions();
+    dims[0] = indices.size();
+    tensor<T, Rank> ret(dims, uninitialized);
+
+    const size_t row_size = rows == 0 ? 0 : a.size() / rows;
+    const T*     src      = a.data();
+    const mint*  idx      = indices.data();
+    T*           dest     = ret.data();
+    parallel_for_rows(ret, [=](size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; ++i)
+            std::copy_n(src + _part_offset(idx[i], mint(rows)) * row_size, row_size, dest + i * row_size);
+    });
+    return ret;
+}
 
-    static _dims_t _get_init_dims(const _init_dims_t& dims, const _init_data_t& data) noexcept
+// dest[[indices]] op= values, applied in the order of indices; the positions in indices are
+// bucketed by the part of dest they write to with a stable counting pass, and each thread
+// applies the bucket of its own part in order, so repeated indices resolve as in a serial loop
+template<typename T, typename Op>
+void _scatter(list<T>& dest, const list<mint>& indices, const list<T>& values, Op op)
+{
+    if (indices.size() != values.size())
+        throw library_dimension_error(WLL_CURRENT_FUNCTION + "\nindices and values have different lengths");
+    _check_part_indices(indices, dest.size());
+    const size_t count  = indices.size();
+    const size_t length = dest.size();
+    const mint*  idx    = indices.data();
+    const T*     src    = values.data();
+    T*           ptr    = dest.data();
+    const size_t num_chunks = std::min(_sort_num_chunks(count), _sort_num_chunks(length));
+    if (num_chunks == 1)
     {
-        return (dims.size() == 0) ? _get_init_data_dims(data) : _convert_to_dims_array<_rank>(dims);
+        for (size_t i = 0; i < count; ++i)
+            op(ptr[_part_offset(idx[i], mint(length))], src[i]);
+        return;
     }
 
-    template<size_t Level>
-    [[nodiscard]] size_t _size_by_level() const noexcept
+    // the part of dest that offset is in, i.e. the last part that begins at or before it
+    auto dest_chunk = [=](size_t offset) { return ((offset + 1) * num_chunks - 1) / length; };
+    std::vector<std::vector<size_t>> offsets(num_chunks, std::vector<size_t>(num_chunks));
+    _for_each_chunk(count, num_chunks, [&](size_t chunk, size_t first, size_t last)
     {
-        static_assert(Level <= _rank);
-        if constexpr (Level == _rank)
-            return size_t(1);
-        else
-            return dims_[Level] * _size_by_level<Level + 1>();
-    }
+        auto& chunk_counts = offsets[chunk];
+        std::fill(chunk_counts.begin(), chunk_counts.end(), size_t(0));
+        for (size_t i = first; i < last; ++i)
+            ++chunk_counts[dest_chunk(_part_offset(idx[i], mint(length)))];
+    });
 
-    template<size_t Level, typename Data>
-    void _fill_init_data_impl(_ptr_t& ptr, const Data& data)
+    // offsets in (dest part, chunk) order keep each bucket in the order of indices;
+    // bucket d is [bucket_begin[d], bucket_begin[d + 1])
+    std::vector<size_t> bucket_begin(num_chunks + 1);
+    size_t offset = 0;
+    for (size_t d = 0; d < num_chunks; ++d)
     {
-        static_assert(Level + 1 <= _rank);
-        const size_t size = data.size();
-        const size_t pad_size = this->dims_[Level] - size;
-        WLL_ASSERT(size > 0 && pad_size >= 0);
-        if constexpr (Level + 1 == _rank)
+        bucket_begin[d] = offset;
+        for (size_t chunk = 0; chunk < num_chunks; ++chunk)
         {
-            for (const auto& value : data)
-                *(ptr++) = value;
-            ptr += pad_size;
-        }
-        else
-        {
-            for (const auto& sub_data : data)
-                this->_fill_init_data_impl<Level + 1>(ptr, sub_data);
-            ptr += _size_by_level<Level + 1>() * pad_size;
+            const size_t chunk_count = offsets[chunk][d];
+            offsets[chunk][d] = offset;
+            offset += chunk_count;
         }
     }
+    bucket_begin[num_chunks] = offset;
 
-    void _fill_init_data(const _init_data_t& data)
+    _owned_vector<size_t> positions(count);
+    size_t* pos = positions.data();
+    _for_each_chunk(count, num_chunks, [&](size_t chunk, size_t first, size_t last)
     {
-        WLL_ASSERT(this->access_ != memory_type::empty);
-        _ptr_t ptr = ptr_;
-        this->_fill_init_data_impl<0>(ptr, data);
-    }
-
-
-private:
-    _dims_t dims_;
-    size_t  size_{};
-    _ptr_t  ptr_ = nullptr;
-    MTensor mtensor_ = nullptr;
-    memory_type access_ = memory_type::empty;
-};
+        auto& chunk_offsets = offsets[chunk];
+        for (size_t i = first; i < last; ++i)
+            pos[chunk_offsets[dest_chunk(_part_offset(idx[i], mint(length)))]++] = i;
+    });
+    parallel_for(0, num_chunks, [&](size_t first, size_t last)
+    {
+        for (size_t d = first; d < last; ++d)
+        {
+            for (size_t k = bucket_begin[d]; k < bucket_begin[d + 1]; ++k)
+            {
+                const size_t i = pos[k];
+                op(ptr[_part_offset(idx[i], mint(length))], src[i]);
+            }
+        }
+    }, 1);
+}
 
+// dest[[indices]] = values, the last of repeated indices wins
 template<typename T>
-using list = tensor<T, 1>;
+void scatter(list<T>& dest, const list<mint>& indices, const list<T>& values)
+{
+    _scatter(dest, indices, values, [](T& x, const T& y) { x = y; });
+}
+
+// dest[[indices]] += values, repeated indices accumulate
 template<typename T>
-using matrix = tensor<T, 2>;
+void scatter_add(list<T>& dest, const list<mint>& indices, const list<T>& values)
+{
+    _scatter(dest, indices, values, [](T& x, const T& y) { x += y; });
+}
 
 template<typename T>
 MTensor _scalar_mtensor(const T& value)
@@ -1058,6 +4497,18 @@ struct tensor_passing_category<const tensor<T, Rank>> :
 template<typename T, size_t Rank>
 struct tensor_passing_category<const tensor<T, Rank>&> :
     std::integral_constant<tensor_passing_by, tensor_passing_by::constant> {};
+template<typename T>
+struct tensor_passing_category<any_tensor<T>> :
+    std::integral_constant<tensor_passing_by, tensor_passing_by::value> {};
+template<typename T>
+struct tensor_passing_category<any_tensor<T>&> :
+    std::integral_constant<tensor_passing_by, tensor_passing_by::reference> {};
+template<typename T>
+struct tensor_passing_category<const any_tensor<T>> :
+    std::integral_constant<tensor_passing_by, tensor_passing_by::constant> {};
+template<typename T>
+struct tensor_passing_category<const any_tensor<T>&> :
+    std::integral_constant<tensor_passing_by, tensor_passing_by::constant> {};
 template<typename Tensor>
 constexpr tensor_passing_by tensor_passing_category_v = tensor_passing_category<Tensor>::value;
 
@@ -1069,6 +4520,43 @@ class _sparse_element;
 template<typename T, size_t Rank, bool IsConst>
 class _sparse_iterator;
 
+template<typename T, size_t Rank>
+class sparse_builder;
+
+// products of sparse matrices up to this many columns, or with at least as many multiply-adds in
+// a part as columns, accumulate in a dense workspace per part; wider ones sort each row instead
+constexpr size_t _sparse_product_dense_columns = size_t(1) << 16;
+
+// bounds of num_parts ranges of rows of a CSR matrix with about equal rows plus explicit elements
+inline std::vector<size_t> _balanced_row_parts(const size_t* row_idx, size_t rows, size_t num_parts)
+{
+    std::vector<size_t> bounds(num_parts + 1, rows);
+    bounds[0] = 0;
+    const size_t total = row_idx[rows] + rows;
+    for (size_t part = 1; part < num_parts; ++part)
+    {
+        const size_t target = total / num_parts * part + total % num_parts * part / num_parts;
+        size_t lo = bounds[part - 1];
+        size_t hi = rows;
+        while (lo < hi)
+        {
+            const size_t mid = lo + (hi - lo) / 2;
+            if (row_idx[mid] + mid < target)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        bounds[part] = lo;
+    }
+    return bounds;
+}
+
+template<typename T, size_t Rank, bool IsConst>
+class _sparse_explicit_iterator;
+
+template<typename Iterator>
+class _sparse_explicit_range;
+
 template<typename T, size_t Rank>
 class sparse_array
 {
@@ -1090,11 +4578,16 @@ public:
     using const_iterator  = _sparse_iterator<value_type, _rank, true>;
     using reference       = _sparse_element<value_type, _rank, false>;
     using const_reference = _sparse_element<value_type, _rank, true>;
+    using explicit_iterator       = _sparse_explicit_iterator<value_type, _rank, false>;
+    using const_explicit_iterator = _sparse_explicit_iterator<value_type, _rank, true>;
     friend reference;
     friend const_reference;
+    friend explicit_iterator;
+    friend const_explicit_iterator;
 
     template<typename U, size_t URank>
     friend class sparse_array;
+    friend class sparse_builder<value_type, _rank>;
 
     sparse_array() = default;
 
@@ -1181,86 +4674,111 @@ public:
     }
 
     explicit sparse_array(const tensor<value_type, _rank>& other, value_type value = value_type{},
-                 double reserve_density = -1.0) :
+                 double reserve_density = -1.0, memory_type access = memory_type::owned) :
         dims_{other.dimensions()}, size_{other.size()},
         implicit_value_{value}, access_{memory_type::owned}
     {
-        constexpr size_t reserve_multiplier = 2;
-        constexpr size_t min_reserve_size   = 1000;
-        constexpr size_t reserve_sqrt_size  = (1000 / 2) * (1000 / 2);
-
-        size_t reserve_size = 0;
-        if (0.0 <= reserve_density && reserve_density <= 1.0)
-            reserve_size = size_t(std::round(reserve_density * size_));
-        else if (size_ <= min_reserve_size)
-            reserve_size = size_;
-        else if (size_ <= reserve_sqrt_size)
-            reserve_size = min_reserve_size;
-        else
-            reserve_size = size_t(std::round(std::sqrt(size_) * reserve_multiplier));
-
-        this->columns_vec_.reserve(reserve_size);
-        this->values_vec_.reserve(reserve_size);
-        this->row_idx_vec_.reserve(this->_row_idx_size());
-        this->row_idx_vec_.push_back(0);
+        this->_select_allocator(access);
+        if (_sort_num_chunks(size_) == 1)
+        {
+            // on one thread, or for small tensors, a second read of the data costs more than
+            // exact allocation saves
+            this->_construct_from_tensor_serial(other.data(), reserve_density);
+            return;
+        }
+        // explicit elements are counted per row in parallel and each row is filled at its
+        // offset, so the storage is allocated once and reserve_density is not needed
+        this->row_idx_vec_.resize(_row_idx_size());
+        size_t* row_idx = this->row_idx_vec_.data();
+        const value_type* data_ptr = other.data();
+        auto count_explicit = [implicit = this->implicit_value_](const value_type* first, const value_type* last)
+        {
+            size_t count = 0;
+            for (; first != last; ++first)
+                count += size_t(*first != implicit);
+            return count;
+        };
 
         if constexpr (_rank == 1)
         {
-            const value_type* data_ptr = other.data();
-            for (size_t i_col = 1; i_col <= dims_[0]; ++i_col, ++data_ptr)
+            const size_t num_chunks = _sort_num_chunks(size_);
+            std::vector<size_t> offsets(num_chunks + 1, 0);
+            _for_each_chunk(size_, num_chunks, [&](size_t chunk, size_t first, size_t last)
             {
-                if (*data_ptr != this->implicit_value_)
-                {
-                    this->columns_vec_.push_back(_column_t({i_col}));
-                    this->values_vec_.push_back(*data_ptr);
-                }
-            }
-            this->nz_size_ = values_vec_.size();
-            this->row_idx_vec_.push_back(nz_size_);
-        }
-        else if (_rank == 2)
-        {
-            size_t i_nz = 0;
-            const value_type* data_ptr = other.data();
-            for (size_t i_row = 0; i_row < dims_[0]; ++i_row)
+                offsets[chunk + 1] = count_explicit(data_ptr + first, data_ptr + last);
+            });
+            std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+            this->_resize_explicit(offsets[num_chunks]);
+            _for_each_chunk(size_, num_chunks, [&](size_t chunk, size_t first, size_t last)
             {
-                for (size_t i_col = 1; i_col <= dims_[1]; ++i_col, ++data_ptr)
+                size_t i_nz = offsets[chunk];
+                for (size_t i = first; i < last; ++i)
                 {
-                    if (*data_ptr != this->implicit_value_)
+                    if (data_ptr[i] != this->implicit_value_)
                     {
-                        this->columns_vec_.push_back(_column_t({i_col}));
-                        this->values_vec_.push_back(*data_ptr);
+                        this->columns_vec_[i_nz] = _column_t({i + 1});
+                        this->values_vec_[i_nz]  = data_ptr[i];
                         ++i_nz;
                     }
                 }
-                this->row_idx_vec_.push_back(i_nz);
-            }
-            this->nz_size_ = i_nz;
+            });
+            row_idx[0] = 0;
+            row_idx[1] = nz_size_;
         }
-        else // _rank >= 3
+        else // _rank >= 2
         {
-            size_t i_nz = 0;
-            const value_type* data_ptr = other.data();
-            for (size_t i_row = 0; i_row < dims_[0]; ++i_row)
+            const size_t row_size = (dims_[0] == 0) ? 0 : size_ / dims_[0];
+            row_idx[0] = 0;
+            parallel_for_rows(other, [&](size_t first, size_t last)
             {
-                this->_construct_from_tensor_impl<1>(i_nz, data_ptr);
-                this->row_idx_vec_.push_back(i_nz);
-            }
-            this->nz_size_ = i_nz;
+                for (size_t i_row = first; i_row < last; ++i_row)
+                {
+                    const value_type* row_ptr = data_ptr + i_row * row_size;
+                    row_idx[i_row + 1] = count_explicit(row_ptr, row_ptr + row_size);
+                }
+            });
+            std::partial_sum(row_idx, row_idx + _row_idx_size(), row_idx);
+            this->_resize_explicit(row_idx[dims_[0]]);
+            parallel_for_rows(other, [&](size_t first, size_t last)
+            {
+                for (size_t i_row = first; i_row < last; ++i_row)
+                {
+                    size_t i_nz = row_idx[i_row];
+                    const value_type* row_ptr = data_ptr + i_row * row_size;
+                    if constexpr (_rank == 2)
+                    {
+                        for (size_t i_col = 1; i_col <= dims_[1]; ++i_col, ++row_ptr)
+                        {
+                            if (*row_ptr != this->implicit_value_)
+                            {
+                                this->columns_vec_[i_nz] = _column_t({i_col});
+                                this->values_vec_[i_nz]  = *row_ptr;
+                                ++i_nz;
+                            }
+                        }
+                    }
+                    else // _rank >= 3
+                    {
+                        this->_construct_from_tensor_impl<false, 1>(i_nz, row_ptr);
+                    }
+                }
+            });
         }
-        this->_update_pointers();
     }
 
-    explicit sparse_array(_dims_t dims, value_type value = value_type{}) :
+    explicit sparse_array(_dims_t dims, value_type value = value_type{},
+                          memory_type access = memory_type::owned) :
         dims_{dims}, size_{_flattened_size(dims)}, nz_size_{size_t(0)},
         implicit_value_{value}, access_{memory_type::owned}
     {
+        this->_select_allocator(access);
         this->row_idx_vec_.resize(_row_idx_size(), size_t(0));
         this->_update_pointers();
     }
 
-    sparse_array(_init_dims_t dims, value_type value = value_type{}) :
-        sparse_array(_convert_to_dims_array<_rank>(dims), value) {}
+    sparse_array(_init_dims_t dims, value_type value = value_type{},
+                 memory_type access = memory_type::owned) :
+        sparse_array(_convert_to_dims_array<_rank>(dims), value, access) {}
 
     sparse_array(_dims_t dims, _init_data_t rules, value_type value = value_type{}) :
         sparse_array(dims, value)
@@ -1350,8 +4868,8 @@ public:
             }
             else // CopyColRow
             {
-                this->columns_vec_ = std::vector<_column_t>(other.columns_, other.columns_ + _nz_size());
-                this->row_idx_vec_ = std::vector<size_t>(other.row_idx_, other.row_idx_ + _row_idx_size());
+                this->columns_vec_ = _owned_vector<_column_t>(other.columns_, other.columns_ + _nz_size());
+                this->row_idx_vec_ = _owned_vector<size_t>(other.row_idx_, other.row_idx_ + _row_idx_size());
             }
 
             if constexpr (SwapValues)
@@ -1362,7 +4880,7 @@ public:
             }
             else if constexpr (SameType) // CopyValues
             {
-                this->values_vec_ = std::vector<size_t>(other.values_, other.values_ + _nz_size());
+                this->values_vec_ = _owned_vector<value_type>(other.values_, other.values_ + _nz_size());
                 this->_update_pointers();
             }
             else // DifferentType CopyValues
@@ -1666,6 +5184,326 @@ public:
         return {*this, idx};
     }
 
+    // the explicit elements only, as (0-based index, value) in row-major order
+    _sparse_explicit_range<explicit_iterator> nonzeros() noexcept
+    {
+        return {{*this, this->_row_of(0), 0}, {*this, 0, _nz_size()}};
+    }
+
+    _sparse_explicit_range<const_explicit_iterator> nonzeros() const noexcept
+    {
+        return {{*this, this->_row_of(0), 0}, {*this, 0, _nz_size()}};
+    }
+
+    // the explicit elements of one row
+    _sparse_explicit_range<explicit_iterator> row_nonzeros(size_t i_row) noexcept
+    {
+        static_assert(_rank >= 2, "rows need rank at least 2");
+        WLL_ASSERT(i_row < this->dims_[0]);
+        return {{*this, i_row, this->row_idx_[i_row]}, {*this, i_row, this->row_idx_[i_row + 1]}};
+    }
+
+    _sparse_explicit_range<const_explicit_iterator> row_nonzeros(size_t i_row) const noexcept
+    {
+        static_assert(_rank >= 2, "rows need rank at least 2");
+        WLL_ASSERT(i_row < this->dims_[0]);
+        return {{*this, i_row, this->row_idx_[i_row]}, {*this, i_row, this->row_idx_[i_row + 1]}};
+    }
+
+    // call fn(index, value) for each explicit element in parallel, split evenly by elements
+    template<typename Fn>
+    void for_each_explicit(Fn fn)
+    {
+        this->_for_each_explicit_impl(this->values_, fn);
+    }
+
+    template<typename Fn>
+    void for_each_explicit(Fn fn) const
+    {
+        this->_for_each_explicit_impl(static_cast<_const_ptr_t>(this->values_), fn);
+    }
+
+    // the transposed matrix, built by a parallel counting sort of the explicit elements by column
+    [[nodiscard]] sparse_array transpose(memory_type access = memory_type::owned) const
+    {
+        static_assert(_rank == 2, "transpose needs rank 2");
+        WLL_ASSERT(this->_check_consistency());
+        const size_t rows = dims_[0];
+        const size_t cols = dims_[1];
+        sparse_array ret(_dims_t{cols, rows}, this->implicit_value_, access);
+        ret._resize_explicit(_nz_size());
+        size_t* ret_row_idx = ret.row_idx_vec_.data();
+        ret_row_idx[0] = 0;
+
+        // each part counts the columns of its rows; offsets in (column, part) order keep the
+        // elements of each new row sorted, and the counts never take more memory than the elements
+        const size_t num_parts = std::max(size_t(1),
+            std::min(_sort_num_chunks(_nz_size()), _nz_size() / std::max(cols, size_t(1))));
+        const std::vector<size_t> bounds = _balanced_row_parts(row_idx_, rows, num_parts);
+        std::vector<size_t> offsets(num_parts * cols, 0);
+        parallel_for(0, num_parts, [&](size_t first, size_t last)
+        {
+            for (size_t part = first; part < last; ++part)
+            {
+                size_t* part_counts = offsets.data() + part * cols;
+                for (size_t i_nz = row_idx_[bounds[part]]; i_nz < row_idx_[bounds[part + 1]]; ++i_nz)
+                    ++part_counts[columns_[i_nz][0] - 1];
+            }
+        }, 1);
+        parallel_for(0, cols, [&](size_t first, size_t last)
+        {
+            for (size_t col = first; col < last; ++col)
+            {
+                size_t total = 0;
+                for (size_t part = 0; part < num_parts; ++part)
+                    total += offsets[part * cols + col];
+                ret_row_idx[col + 1] = total;
+            }
+        });
+        std::partial_sum(ret_row_idx, ret_row_idx + cols + 1, ret_row_idx);
+        parallel_for(0, cols, [&](size_t first, size_t last)
+        {
+            for (size_t col = first; col < last; ++col)
+            {
+                size_t offset = ret_row_idx[col];
+                for (size_t part = 0; part < num_parts; ++part)
+                {
+                    const size_t count = offsets[part * cols + col];
+                    offsets[part * cols + col] = offset;
+                    offset += count;
+                }
+            }
+        });
+
+        parallel_for(0, num_parts, [&](size_t first, size_t last)
+        {
+            for (size_t part = first; part < last; ++part)
+            {
+                size_t* part_offsets = offsets.data() + part * cols;
+                for (size_t i_row = bounds[part]; i_row < bounds[part + 1]; ++i_row)
+                {
+                    for (size_t i_nz = row_idx_[i_row]; i_nz < row_idx_[i_row + 1]; ++i_nz)
+                    {
+                        const size_t dest = part_offsets[columns_[i_nz][0] - 1]++;
+                        ret.columns_vec_[dest] = _column_t({i_row + 1});
+                        ret.values_vec_[dest]  = values_[i_nz];
+                    }
+                }
+            }
+        }, 1);
+        return ret;
+    }
+
+    // Gustavson product with b, row-parallel: a symbolic pass counts the columns of each row of
+    // the result and a numeric pass fills them sorted; elements equal to value are left implicit
+    [[nodiscard]] sparse_array _multiply_sparse(const sparse_array& b, value_type value,
+                                                memory_type access) const
+    {
+        static_assert(_rank == 2, "products need rank 2");
+        WLL_ASSERT(this->_check_consistency());
+        WLL_ASSERT(b._check_consistency());
+        if (this->dims_[1] != b.dims_[0])
+            throw library_dimension_error(WLL_CURRENT_FUNCTION + "\nincompatible dimensions");
+        if (this->implicit_value_ != value_type{} || b.implicit_value_ != value_type{})
+            throw library_function_error(WLL_CURRENT_FUNCTION +
+                "\nnon-zero implicit values of the factors make the product dense");
+        const size_t rows = this->dims_[0];
+        const size_t cols = b.dims_[1];
+        // with a non-zero value, the positions no product reaches are explicit zeros
+        const bool is_dense = (value != value_type{});
+        constexpr size_t no_row = ~size_t(0);
+
+        // parts are balanced by the multiply-adds of their rows; each part is one task with
+        // its own workspace, one marker and one accumulator per column unless the product is
+        // wide, then the columns and products of one row, sorted
+        std::vector<size_t> work(rows + 1, 0);
+        parallel_for(0, rows, [&](size_t first, size_t last)
+        {
+            for (size_t i_row = first; i_row < last; ++i_row)
+            {
+                size_t row_work = 0;
+                for (size_t i_nz = row_idx_[i_row]; i_nz < row_idx_[i_row + 1]; ++i_nz)
+                {
+                    const size_t k = columns_[i_nz][0] - 1;
+                    row_work += b.row_idx_[k + 1] - b.row_idx_[k];
+                }
+                work[i_row + 1] = row_work;
+            }
+        });
+        std::partial_sum(work.begin(), work.end(), work.begin());
+        const size_t num_parts = std::max(size_t(1), std::min(rows, get_thread_pool().size()));
+        const std::vector<size_t> bounds = _balanced_row_parts(work.data(), rows, num_parts);
+        auto dense_workspace = [&](size_t part)
+        {
+            const size_t part_work = work[bounds[part + 1]] - work[bounds[part]];
+            return is_dense || cols <= std::max(_sparse_product_dense_columns, part_work);
+        };
+
+        // symbolic pass
+        sparse_array ret(_dims_t{rows, cols}, value, access);
+        size_t* row_idx = ret.row_idx_vec_.data();
+        parallel_for(0, num_parts, [&](size_t first, size_t last)
+        {
+            for (size_t part = first; part < last; ++part)
+            {
+                if (is_dense)
+                {
+                    std::fill(row_idx + bounds[part] + 1, row_idx + bounds[part + 1] + 1, cols);
+                    continue;
+                }
+                if (!dense_workspace(part))
+                {
+                    std::vector<size_t> row_cols;
+                    for (size_t i_row = bounds[part]; i_row < bounds[part + 1]; ++i_row)
+                    {
+                        row_cols.clear();
+                        for (size_t i_nz = row_idx_[i_row]; i_nz < row_idx_[i_row + 1]; ++i_nz)
+                        {
+                            const size_t k = columns_[i_nz][0] - 1;
+                            for (size_t j_nz = b.row_idx_[k]; j_nz < b.row_idx_[k + 1]; ++j_nz)
+                                row_cols.push_back(b.columns_[j_nz][0] - 1);
+                        }
+                        std::sort(row_cols.begin(), row_cols.end());
+                        row_idx[i_row + 1] = size_t(std::unique(row_cols.begin(), row_cols.end()) - row_cols.begin());
+                    }
+                    continue;
+                }
+                std::vector<size_t> marker(cols, no_row);
+                for (size_t i_row = bounds[part]; i_row < bounds[part + 1]; ++i_row)
+                {
+                    size_t count = 0;
+                    for (size_t i_nz = row_idx_[i_row]; i_nz < row_idx_[i_row + 1]; ++i_nz)
+                    {
+                        const size_t k = columns_[i_nz][0] - 1;
+                        for (size_t j_nz = b.row_idx_[k]; j_nz < b.row_idx_[k + 1]; ++j_nz)
+                        {
+                            const size_t j = b.columns_[j_nz][0] - 1;
+                            if (marker[j] != i_row)
+                            {
+                                marker[j] = i_row;
+                                ++count;
+                            }
+                        }
+                    }
+                    row_idx[i_row + 1] = count;
+                }
+            }
+        }, 1);
+        std::partial_sum(row_idx, row_idx + rows + 1, row_idx);
+        ret._resize_explicit(row_idx[rows]);
+
+        // numeric pass
+        std::vector<size_t> kept(rows, 0);
+        parallel_for(0, num_parts, [&](size_t first, size_t last)
+        {
+            for (size_t part = first; part < last; ++part)
+            {
+                if (!dense_workspace(part))
+                {
+                    // products in the order of the dense workspace, so that sums are the same
+                    std::vector<std::pair<size_t, value_type>> products;
+                    for (size_t i_row = bounds[part]; i_row < bounds[part + 1]; ++i_row)
+                    {
+                        products.clear();
+                        for (size_t i_nz = row_idx_[i_row]; i_nz < row_idx_[i_row + 1]; ++i_nz)
+                        {
+                            const size_t     k       = columns_[i_nz][0] - 1;
+                            const value_type a_value = values_[i_nz];
+                            for (size_t j_nz = b.row_idx_[k]; j_nz < b.row_idx_[k + 1]; ++j_nz)
+                                products.emplace_back(b.columns_[j_nz][0] - 1, a_value * b.values_[j_nz]);
+                        }
+                        std::stable_sort(products.begin(), products.end(),
+                                         [](const auto& x, const auto& y) { return x.first < y.first; });
+                        size_t dest = row_idx[i_row];
+                        for (size_t i = 0; i < products.size();)
+                        {
+                            const size_t j = products[i].first;
+                            value_type   x = products[i].second;
+                            for (++i; i < products.size() && products[i].first == j; ++i)
+                                x += products[i].second;
+                            if (x != value)
+                            {
+                                ret.columns_vec_[dest] = _column_t({j + 1});
+                                ret.values_vec_[dest]  = x;
+                                ++dest;
+                            }
+                        }
+                        kept[i_row] = dest - row_idx[i_row];
+                    }
+                    continue;
+                }
+                std::vector<size_t>     marker(cols, no_row);
+                std::vector<value_type> acc(cols);
+                std::vector<size_t>     touched;
+                for (size_t i_row = bounds[part]; i_row < bounds[part + 1]; ++i_row)
+                {
+                    touched.clear();
+                    for (size_t i_nz = row_idx_[i_row]; i_nz < row_idx_[i_row + 1]; ++i_nz)
+                    {
+                        const size_t     k       = columns_[i_nz][0] - 1;
+                        const value_type a_value = values_[i_nz];
+                        for (size_t j_nz = b.row_idx_[k]; j_nz < b.row_idx_[k + 1]; ++j_nz)
+                        {
+                            const size_t j = b.columns_[j_nz][0] - 1;
+                            if (marker[j] != i_row)
+                            {
+                                marker[j] = i_row;
+                                acc[j]    = a_value * b.values_[j_nz];
+                                touched.push_back(j);
+                            }
+                            else
+                            {
+                                acc[j] += a_value * b.values_[j_nz];
+                            }
+                        }
+                    }
+
+                    size_t dest = row_idx[i_row];
+                    auto emit = [&](size_t j, const value_type& x)
+                    {
+                        if (x != value)
+                        {
+                            ret.columns_vec_[dest] = _column_t({j + 1});
+                            ret.values_vec_[dest]  = x;
+                            ++dest;
+                        }
+                    };
+                    if (is_dense)
+                    {
+                        for (size_t j = 0; j < cols; ++j)
+                            emit(j, marker[j] == i_row ? acc[j] : value_type{});
+                    }
+                    else
+                    {
+                        std::sort(touched.begin(), touched.end());
+                        for (size_t j : touched)
+                            emit(j, acc[j]);
+                    }
+                    kept[i_row] = dest - row_idx[i_row];
+                }
+            }
+        }, 1);
+
+        // remove the room of elements that came out equal to value
+        const size_t kept_size = std::accumulate(kept.begin(), kept.end(), size_t(0));
+        if (kept_size == ret._nz_size())
+            return ret;
+        sparse_array compact(_dims_t{rows, cols}, value, access);
+        size_t* compact_row_idx = compact.row_idx_vec_.data();
+        compact_row_idx[0] = 0;
+        std::partial_sum(kept.begin(), kept.end(), compact_row_idx + 1);
+        compact._resize_explicit(kept_size);
+        parallel_for(0, rows, [&](size_t first, size_t last)
+        {
+            for (size_t i_row = first; i_row < last; ++i_row)
+            {
+                std::copy_n(ret.columns_ + row_idx[i_row], kept[i_row], compact.columns_ + compact_row_idx[i_row]);
+                std::copy_n(ret.values_ + row_idx[i_row], kept[i_row], compact.values_ + compact_row_idx[i_row]);
+            }
+        });
+        return compact;
+    }
+
     [[nodiscard]] MSparseArray get_msparse() const
     {
         using mtype = typename derive_tensor_data_type<value_type>::convert_type;
@@ -1750,40 +5588,82 @@ public:
     explicit operator tensor<value_type, _rank>() const
     {
         WLL_ASSERT(this->_check_consistency());
-        tensor<value_type, _rank> ret(this->dims_);
+        tensor<value_type, _rank> ret(this->dims_, uninitialized);
         std::fill(ret.begin(), ret.end(), this->implicit_value_);
 
         if constexpr (_rank == 1)
         {
-            size_t i_nz = 0;
-            for (; i_nz < _nz_size(); ++i_nz)
-                ret._tuple_at(_make_zero_based_idx(0, i_nz)) = values_[i_nz];
+            size_t i_nz = 0;
+            for (; i_nz < _nz_size(); ++i_nz)
+                ret._tuple_at(_make_zero_based_idx(0, i_nz)) = values_[i_nz];
+        }
+        else
+        {
+            size_t i_nz = 0;
+            for (size_t i_row = 1; i_row < _row_idx_size(); ++i_row)
+            {
+                for (; i_nz < row_idx_vec_[i_row]; ++i_nz)
+                    ret._tuple_at(_make_zero_based_idx(i_row - 1, i_nz)) = values_[i_nz];
+            }
+        }
+        return ret;
+    }
+
+private:
+
+    [[nodiscard]] size_t _nz_size() const noexcept
+    {
+        return this->nz_size_;
+    }
+
+    [[nodiscard]] size_t _row_idx_size() const noexcept
+    {
+        return _rank == 1 ? 2 : (dims_[0] + 1);
+    }
+
+    // build from dense data in one pass, appending to storage reserved by reserve_density
+    void _construct_from_tensor_serial(const value_type* data_ptr, double reserve_density)
+    {
+        constexpr size_t reserve_multiplier = 2;
+        constexpr size_t min_reserve_size   = 1000;
+        constexpr size_t reserve_sqrt_size  = (1000 / 2) * (1000 / 2);
+
+        size_t reserve_size = 0;
+        if (0.0 <= reserve_density && reserve_density <= 1.0)
+            reserve_size = size_t(std::round(reserve_density * size_));
+        else if (size_ <= min_reserve_size)
+            reserve_size = size_;
+        else if (size_ <= reserve_sqrt_size)
+            reserve_size = min_reserve_size;
+        else
+            reserve_size = size_t(std::round(std::sqrt(size_) * reserve_multiplier));
+
+        this->columns_vec_.reserve(reserve_size);
+        this->values_vec_.reserve(reserve_size);
+        this->row_idx_vec_.reserve(this->_row_idx_size());
+        this->row_idx_vec_.push_back(0);
+
+        size_t i_nz = 0;
+        if constexpr (_rank == 1)
+        {
+            this->_construct_from_tensor_impl<true, 0>(i_nz, data_ptr);
+            this->row_idx_vec_.push_back(i_nz);
         }
-        else
+        else // _rank >= 2
         {
-            size_t i_nz = 0;
-            for (size_t i_row = 1; i_row < _row_idx_size(); ++i_row)
+            for (size_t i_row = 0; i_row < dims_[0]; ++i_row)
             {
-                for (; i_nz < row_idx_vec_[i_row]; ++i_nz)
-                    ret._tuple_at(_make_zero_based_idx(i_row - 1, i_nz)) = values_[i_nz];
+                this->_construct_from_tensor_impl<true, 1>(i_nz, data_ptr);
+                this->row_idx_vec_.push_back(i_nz);
             }
         }
-        return ret;
-    }
-
-private:
-
-    [[nodiscard]] size_t _nz_size() const noexcept
-    {
-        return this->nz_size_;
-    }
-
-    [[nodiscard]] size_t _row_idx_size() const noexcept
-    {
-        return _rank == 1 ? 2 : (dims_[0] + 1);
+        this->nz_size_ = i_nz;
+        this->_update_pointers();
     }
 
-    template<size_t Level, typename... ICol>
+    // write the explicit elements below one row, in row-major order, from i_nz on;
+    // appended to the storage if Append, written at i_nz otherwise
+    template<bool Append, size_t Level, typename... ICol>
     void _construct_from_tensor_impl(size_t& i_nz, const value_type*& data_ptr, ICol... i_col)
     {
         if constexpr (Level + 1 == _rank)
@@ -1792,8 +5672,16 @@ private:
             {
                 if (*data_ptr != this->implicit_value_)
                 {
-                    this->columns_vec_.push_back(_column_t({i_col..., i_col_x}));
-                    this->values_vec_.push_back(*data_ptr);
+                    if constexpr (Append)
+                    {
+                        this->columns_vec_.push_back(_column_t({i_col..., i_col_x}));
+                        this->values_vec_.push_back(*data_ptr);
+                    }
+                    else
+                    {
+                        this->columns_vec_[i_nz] = _column_t({i_col..., i_col_x});
+                        this->values_vec_[i_nz]  = *data_ptr;
+                    }
                     ++i_nz;
                 }
             }
@@ -1802,11 +5690,36 @@ private:
         {
             for (size_t i_col_x = 1; i_col_x <= this->dims_[Level]; ++i_col_x)
             {
-                this->_construct_from_tensor_impl<Level + 1>(i_nz, data_ptr, i_col..., i_col_x);
+                this->_construct_from_tensor_impl<Append, Level + 1>(i_nz, data_ptr, i_col..., i_col_x);
             }
         }
     }
 
+    // the row that holds explicit element i_nz, the first non-empty one for i_nz == 0
+    [[nodiscard]] size_t _row_of(size_t i_nz) const noexcept
+    {
+        if constexpr (_rank == 1)
+            return 0;
+        else
+            return size_t(std::upper_bound(row_idx_, row_idx_ + _row_idx_size(), i_nz) - row_idx_) - 1;
+    }
+
+    template<typename ValuePtr, typename Fn>
+    void _for_each_explicit_impl(ValuePtr values, Fn& fn) const
+    {
+        parallel_for(0, _nz_size(), [&](size_t first, size_t last)
+        {
+            size_t i_row = this->_row_of(first);
+            for (size_t i_nz = first; i_nz < last; ++i_nz)
+            {
+                if constexpr (_rank >= 2)
+                    while (row_idx_[i_row + 1] <= i_nz)
+                        ++i_row;
+                fn(this->_make_zero_based_idx(i_row, i_nz), values[i_nz]);
+            }
+        });
+    }
+
     template<size_t... Is>
     _idx_t _make_zero_based_idx_impl(size_t row_idx, size_t i_nz,
                                      std::index_sequence<Is...>) const
@@ -1832,6 +5745,18 @@ private:
             return this->dims_[_rank - 1] == size_t(other_dims[_rank - 1]);
     }
 
+    void _select_allocator(memory_type access)
+    {
+        // scratch sparse arrays are owned sparse arrays whose vectors draw from global_scratch
+        WLL_ASSERT(access == memory_type::owned || access == memory_type::scratch);
+        if (access == memory_type::scratch)
+        {
+            this->values_vec_  = _owned_vector<value_type>(scratch_allocator<value_type>());
+            this->columns_vec_ = _owned_vector<_column_t>(scratch_allocator<_column_t>());
+            this->row_idx_vec_ = _owned_vector<size_t>(scratch_allocator<size_t>());
+        }
+    }
+
     void _update_pointers()
     {
         WLL_ASSERT(access_ == memory_type::owned);
@@ -1879,6 +5804,17 @@ private:
         this->_update_pointers();
     }
 
+    // size the explicit storage for nz_size elements to be written in place
+    void _resize_explicit(size_t nz_size)
+    {
+        WLL_ASSERT(this->access_ == memory_type::owned);
+        this->values_vec_.resize(nz_size);
+        this->columns_vec_.resize(nz_size);
+        this->row_idx_vec_.resize(_row_idx_size());
+        this->nz_size_ = nz_size;
+        this->_update_pointers();
+    }
+
     void _insert_explicit(size_t offset, const value_type& value,
                           const _column_t& col_idx, size_t row_idx_offset)
     {
@@ -1976,9 +5912,9 @@ private:
 
     memory_type  access_  = memory_type::empty;
     MSparseArray msparse_ = nullptr;
-    std::vector<value_type> values_vec_{};
-    std::vector<_column_t>  columns_vec_{}; // 1-based numbering
-    std::vector<size_t>     row_idx_vec_{};
+    _owned_vector<value_type> values_vec_{};
+    _owned_vector<_column_t>  columns_vec_{}; // 1-based numbering
+    _owned_vector<size_t>     row_idx_vec_{};
 };
 
 template<typename T, size_t Rank, bool IsConst>
@@ -2305,106 +6241,637 @@ private:
         }
         else
         {
-            idx_[Level]--;
+            idx_[Level]--;
+        }
+    }
+
+    // decrement by diff (diff >= 0) on Level
+    template<size_t Level = _rank - 1>
+    void explicit_dec(size_t diff)
+    {
+        const size_t dim = sparse_.dimension(Level);
+        ptrdiff_t post_sub = idx_[Level] - diff;
+        if constexpr (Level > 0)
+        {
+            if (post_sub >= 0) // if will not underflow
+            {
+                idx_[Level] -= diff;
+            }
+            else if (size_t(-post_sub) <= dim) // if will underflow only once
+            {
+                idx_[Level] -= (diff - dim);
+                explicit_dec<Level - 1>(); // carry
+            }
+            else // if underflow more than once
+            {
+                size_t val  = size_t(-post_sub) - 1;
+                size_t quot = val / dim;
+                size_t rem  = val % dim;
+                idx_[Level] = dim - (rem + 1);
+                explicit_dec<Level - 1>(quot);
+            }
+        }
+        else
+        {
+            idx_[Level] = size_t(post_sub);
+        }
+    }
+
+    // calculate the diff, where indices1 = indices2 + diff
+    template<size_t Level = _rank - 1>
+    ptrdiff_t difference(const _my_type& other) const
+    {
+        ptrdiff_t    diff = this->idx_[Level] - other.idx_[Level];
+        const size_t dim  = sparse_.dimension(Level);
+        if constexpr (Level == 0)
+            return diff;
+        else
+            return dim * difference<Level - 1>(other) + diff;
+    }
+
+    template<size_t Level = 0>
+    bool cmp_equal(const _my_type& other) const
+    {
+        bool equal = (this->idx_[Level] == other.idx_[Level]);
+        if constexpr (Level + 1 < _rank)
+            return equal && cmp_equal<Level + 1>(other);
+        else
+            return equal;
+    }
+
+    template<size_t Level = 0>
+    bool cmp_less(const _my_type& other) const
+    {
+        if constexpr (Level + 1 < _rank)
+        {
+            ptrdiff_t diff = this->idx_[Level] - other.idx_[Level];
+            if (diff < 0)
+                return true;
+            else if (diff > 0)
+                return false;
+            else
+                return cmp_less<Level + 1>(other);
+        }
+        else
+        {
+            return this->idx_[Level] < other.idx_[Level];
+        }
+    }
+
+    template<size_t Level = 0>
+    bool cmp_greater(const _my_type& other) const
+    {
+        if constexpr (Level + 1 < _rank)
+        {
+            ptrdiff_t diff = this->idx_[Level] - other.idx_[Level];
+            if (diff > 0)
+                return true;
+            else if (diff < 0)
+                return false;
+            else
+                return cmp_greater<Level + 1>(other);
+        }
+        else
+        {
+            return this->idx_[Level] > other.idx_[Level];
+        }
+    }
+
+private:
+    _sparse_t sparse_;
+    _idx_t    idx_;
+};
+
+// an explicit element of a sparse array
+template<typename T, size_t Rank, bool IsConst>
+struct _sparse_explicit_entry
+{
+    std::array<size_t, Rank> index; // 0-based
+    std::conditional_t<IsConst, const T&, T&> value;
+};
+
+// walks the explicit elements through row_idx_, columns_ and values_ directly
+template<typename T, size_t Rank, bool IsConst>
+class _sparse_explicit_iterator
+{
+public:
+    using iterator_category = std::input_iterator_tag; // operator* returns an entry by value
+    using value_type        = _sparse_explicit_entry<T, Rank, IsConst>;
+    using difference_type   = ptrdiff_t;
+    using reference         = value_type;
+    using pointer           = void;
+
+    using _my_type  = _sparse_explicit_iterator;
+    using _sparse_t = std::conditional_t<IsConst, const sparse_array<T, Rank>&, sparse_array<T, Rank>&>;
+
+    _sparse_explicit_iterator(_sparse_t sparse, size_t i_row, size_t i_nz) noexcept :
+        sparse_{&sparse}, i_row_{i_row}, i_nz_{i_nz} {}
+
+    value_type operator*() const
+    {
+        return {sparse_->_make_zero_based_idx(i_row_, i_nz_), sparse_->values_[i_nz_]};
+    }
+
+    _my_type& operator++() noexcept
+    {
+        ++i_nz_;
+        if constexpr (Rank >= 2)
+        {
+            // skip rows without explicit elements, stopping at the last row
+            const size_t* row_idx = sparse_->row_idx_;
+            const size_t  rows    = sparse_->dims_[0];
+            while (i_row_ + 1 < rows && row_idx[i_row_ + 1] <= i_nz_)
+                ++i_row_;
+        }
+        return *this;
+    }
+
+    _my_type operator++(int) noexcept
+    {
+        _my_type ret = *this;
+        ++(*this);
+        return ret;
+    }
+
+    bool operator==(const _my_type& other) const noexcept
+    {
+        return this->i_nz_ == other.i_nz_;
+    }
+
+    bool operator!=(const _my_type& other) const noexcept
+    {
+        return !((*this) == other);
+    }
+
+    [[nodiscard]] size_t _explicit_offset() const noexcept
+    {
+        return this->i_nz_;
+    }
+
+private:
+    std::remove_reference_t<_sparse_t>* sparse_;
+    size_t i_row_;
+    size_t i_nz_;
+};
+
+template<typename Iterator>
+class _sparse_explicit_range
+{
+public:
+    _sparse_explicit_range(Iterator first, Iterator last) noexcept :
+        first_{first}, last_{last} {}
+
+    Iterator begin() const noexcept
+    {
+        return this->first_;
+    }
+
+    Iterator end() const noexcept
+    {
+        return this->last_;
+    }
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return this->last_._explicit_offset() - this->first_._explicit_offset();
+    }
+
+private:
+    Iterator first_;
+    Iterator last_;
+};
+
+// how sparse_builder combines values added at the same position
+enum class duplicate_policy
+{
+    last, // the value added last wins
+    sum   // values are summed in the order they were added
+};
+
+// collects (index, value) entries in any order and compresses them into a sparse_array at once,
+// instead of inserting each element into the sorted explicit storage
+template<typename T, size_t Rank>
+class sparse_builder
+{
+public:
+    using value_type   = T;
+    static constexpr size_t _rank = Rank;
+    using _dims_t      = std::array<size_t, _rank>;
+    using _idx_t       = std::array<size_t, _rank>;
+    using _init_dims_t = std::initializer_list<size_t>;
+    using _sparse_t    = sparse_array<value_type, _rank>;
+    using _column_t    = typename _sparse_t::_column_t;
+    static_assert(_rank > 0);
+
+    explicit sparse_builder(_dims_t dims, value_type value = value_type{},
+                            duplicate_policy duplicates = duplicate_policy::last) :
+        dims_{dims}, implicit_value_{value}, duplicates_{duplicates} {}
+
+    sparse_builder(_init_dims_t dims, value_type value = value_type{},
+                   duplicate_policy duplicates = duplicate_policy::last) :
+        sparse_builder(_convert_to_dims_array<_rank>(dims), value, duplicates) {}
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return this->entries_.size();
+    }
+
+    void reserve(size_t count)
+    {
+        this->entries_.reserve(count);
+    }
+
+    void clear() noexcept
+    {
+        this->entries_.clear();
+    }
+
+    // add a value at a 0-based index, as in the rules of sparse_array
+    void add(const _idx_t& idx, const value_type& value)
+    {
+        size_t pos = 0;
+        for (size_t i = 0; i < _rank; ++i)
+        {
+            if (idx[i] >= this->dims_[i])
+                throw std::out_of_range(WLL_CURRENT_FUNCTION + "\nindex out of range");
+            pos = pos * this->dims_[i] + idx[i];
+        }
+        this->entries_.push_back({pos, value});
+    }
+
+    // radix sort the entries by position and compress them into CSR form in parallel;
+    // the builder is left empty
+    [[nodiscard]] _sparse_t finalize(memory_type access = memory_type::owned)
+    {
+        const size_t count = this->entries_.size();
+        _radix_sort(this->entries_.data(), count, [](const _entry& e) { return e.pos_; });
+
+        // parts are moved forward to start on the first entry of a position
+        const size_t num_chunks = _sort_num_chunks(count);
+        std::vector<size_t> bounds(num_chunks + 1);
+        for (size_t chunk = 0; chunk <= num_chunks; ++chunk)
+        {
+            size_t bound = _chunk_begin(count, num_chunks, chunk);
+            while (0 < bound && bound < count && entries_[bound].pos_ == entries_[bound - 1].pos_)
+                ++bound;
+            bounds[chunk] = bound;
+        }
+
+        std::vector<size_t> offsets(num_chunks + 1, 0);
+        _for_each_chunk(count, num_chunks, [&](size_t chunk, size_t, size_t)
+        {
+            offsets[chunk + 1] = this->_compress(bounds[chunk], bounds[chunk + 1], [](size_t, size_t, const value_type&) {});
+        });
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+        const size_t nz_size = offsets[num_chunks];
+
+        _sparse_t ret(this->dims_, this->implicit_value_, access);
+        ret._resize_explicit(nz_size);
+        value_type* values  = ret.values_vec_.data();
+        _column_t*  columns = ret.columns_vec_.data();
+        size_t*     row_idx = ret.row_idx_vec_.data();
+        _owned_vector<size_t> rows(_rank == 1 ? 0 : nz_size);
+        _for_each_chunk(count, num_chunks, [&](size_t chunk, size_t, size_t)
+        {
+            this->_compress(bounds[chunk], bounds[chunk + 1], [&](size_t i_nz, size_t pos, const value_type& value)
+            {
+                i_nz += offsets[chunk];
+                values[i_nz] = value;
+                if constexpr (_rank == 1)
+                {
+                    columns[i_nz][0] = pos + 1;
+                }
+                else
+                {
+                    for (size_t level = _rank - 1; level > 0; --level)
+                    {
+                        columns[i_nz][level - 1] = pos % this->dims_[level] + 1;
+                        pos /= this->dims_[level];
+                    }
+                    rows[i_nz] = pos;
+                }
+            });
+        });
+
+        if constexpr (_rank == 1)
+        {
+            row_idx[0] = 0;
+            row_idx[1] = nz_size;
+        }
+        else
+        {
+            // row_idx[r] is the first element in a row >= r
+            parallel_for(0, nz_size, [&](size_t first, size_t last)
+            {
+                for (size_t i_nz = first; i_nz < last; ++i_nz)
+                {
+                    const size_t row_first = (i_nz == 0) ? 0 : rows[i_nz - 1] + 1;
+                    for (size_t row = row_first; row <= rows[i_nz]; ++row)
+                        row_idx[row] = i_nz;
+                }
+            });
+            const size_t row_first = (nz_size == 0) ? 0 : rows[nz_size - 1] + 1;
+            std::fill(row_idx + row_first, row_idx + this->dims_[0] + 1, nz_size);
         }
+        _owned_vector<_entry>().swap(this->entries_);
+        return ret;
     }
 
-    // decrement by diff (diff >= 0) on Level
-    template<size_t Level = _rank - 1>
-    void explicit_dec(size_t diff)
+private:
+    struct _entry
     {
-        const size_t dim = sparse_.dimension(Level);
-        ptrdiff_t post_sub = idx_[Level] - diff;
-        if constexpr (Level > 0)
+        size_t     pos_; // row-major flat position
+        value_type value_;
+    };
+
+    // combine the entries of each position in [first, last) and call emit(i, pos, value) for
+    // the i-th combined value that is not implicit; returns the number of such values
+    template<typename Emit>
+    size_t _compress(size_t first, size_t last, Emit emit) const
+    {
+        const _entry* entries = this->entries_.data();
+        size_t i_nz = 0;
+        for (size_t i = first; i < last;)
         {
-            if (post_sub >= 0) // if will not underflow
-            {
-                idx_[Level] -= diff;
-            }
-            else if (size_t(-post_sub) <= dim) // if will underflow only once
-            {
-                idx_[Level] -= (diff - dim);
-                explicit_dec<Level - 1>(); // carry
-            }
-            else // if underflow more than once
+            const size_t pos = entries[i].pos_;
+            value_type value = entries[i].value_;
+            for (++i; i < this->entries_.size() && entries[i].pos_ == pos; ++i)
             {
-                size_t val  = size_t(-post_sub) - 1;
-                size_t quot = val / dim;
-                size_t rem  = val % dim;
-                idx_[Level] = dim - (rem + 1);
-                explicit_dec<Level - 1>(quot);
+                if (this->duplicates_ == duplicate_policy::sum)
+                    value += entries[i].value_;
+                else
+                    value = entries[i].value_;
             }
+            if (value != this->implicit_value_)
+                emit(i_nz++, pos, value);
         }
-        else
-        {
-            idx_[Level] = size_t(post_sub);
-        }
+        return i_nz;
     }
 
-    // calculate the diff, where indices1 = indices2 + diff
-    template<size_t Level = _rank - 1>
-    ptrdiff_t difference(const _my_type& other) const
-    {
-        ptrdiff_t    diff = this->idx_[Level] - other.idx_[Level];
-        const size_t dim  = sparse_.dimension(Level);
-        if constexpr (Level == 0)
-            return diff;
-        else
-            return dim * difference<Level - 1>(other) + diff;
-    }
+private:
+    _dims_t               dims_;
+    value_type            implicit_value_{};
+    duplicate_policy      duplicates_ = duplicate_policy::last;
+    _owned_vector<_entry> entries_{};
+};
 
-    template<size_t Level = 0>
-    bool cmp_equal(const _my_type& other) const
-    {
-        bool equal = (this->idx_[Level] == other.idx_[Level]);
-        if constexpr (Level + 1 < _rank)
-            return equal && cmp_equal<Level + 1>(other);
-        else
-            return equal;
-    }
 
-    template<size_t Level = 0>
-    bool cmp_less(const _my_type& other) const
-    {
-        if constexpr (Level + 1 < _rank)
+// call fn(first_row, last_row) in parallel on ranges of rows balanced by their explicit elements
+template<typename T, typename Fn>
+void _for_each_row_part(const sparse_array<T, 2>& a, Fn fn)
+{
+    const size_t rows      = a.dimension(0);
+    const size_t num_parts = std::min(rows, 8 * get_thread_pool().size());
+    if (num_parts == 0)
+        return;
+    const std::vector<size_t> bounds = _balanced_row_parts(a.row_indices_pointer(), rows, num_parts);
+    parallel_for(0, num_parts, [&](size_t first, size_t last)
+    {
+        for (size_t part = first; part < last; ++part)
+            fn(bounds[part], bounds[part + 1]);
+    }, 1);
+}
+
+// sum of (values - implicit) * x over the explicit elements [first, last) of a row, with four
+// independent accumulators so that the gathers of x overlap
+template<typename T, typename Column>
+T _sparse_row_dot(const T* values, const Column* columns, size_t first, size_t last,
+                  const T* x, T implicit) noexcept
+{
+    T acc[4] = {};
+    size_t i_nz = first;
+    for (; i_nz + 4 <= last; i_nz += 4)
+    {
+        acc[0] += (values[i_nz + 0] - implicit) * x[columns[i_nz + 0][0] - 1];
+        acc[1] += (values[i_nz + 1] - implicit) * x[columns[i_nz + 1][0] - 1];
+        acc[2] += (values[i_nz + 2] - implicit) * x[columns[i_nz + 2][0] - 1];
+        acc[3] += (values[i_nz + 3] - implicit) * x[columns[i_nz + 3][0] - 1];
+    }
+    for (; i_nz < last; ++i_nz)
+        acc[0] += (values[i_nz] - implicit) * x[columns[i_nz][0] - 1];
+    return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+// y = a . x, for an output y of length a.dimension(0) that does not overlap x and can be
+// reused across calls; a non-zero implicit value contributes implicit * Total[x] to every row
+template<typename T>
+void multiply(const sparse_array<T, 2>& a, const list<T>& x, list<T>& y_out)
+{
+    if (a.dimension(1) != x.size() || a.dimension(0) != y_out.size())
+        throw library_dimension_error(WLL_CURRENT_FUNCTION + "\nincompatible dimensions");
+    const size_t* row_idx  = a.row_indices_pointer();
+    const auto*   columns  = a.columns_pointer();
+    const T*      values   = a.values_pointer();
+    const T*      x_ptr    = x.data();
+    const T       implicit = a.implicit_value();
+    const T       implicit_sum = (implicit == T{} || x.size() == 0) ? T{} : implicit * sum(x);
+
+    T* y = y_out.data();
+    _for_each_row_part(a, [&](size_t first, size_t last)
+    {
+        for (size_t i_row = first; i_row < last; ++i_row)
+            y[i_row] = implicit_sum +
+                _sparse_row_dot(values, columns, row_idx[i_row], row_idx[i_row + 1], x_ptr, implicit);
+    });
+}
+
+// a . x
+template<typename T>
+list<T> multiply(const sparse_array<T, 2>& a, const list<T>& x, memory_type access = memory_type::result)
+{
+    list<T> ret({a.dimension(0)}, uninitialized, access);
+    multiply(a, x, ret);
+    return ret;
+}
+
+// y = a . x for a dense matrix x, accumulating whole rows of x; y must not overlap x
+template<typename T>
+void multiply(const sparse_array<T, 2>& a, const matrix<T>& x, matrix<T>& y_out)
+{
+    if (a.dimension(1) != x.dimension(0) || a.dimension(0) != y_out.dimension(0) ||
+        x.dimension(1) != y_out.dimension(1))
+        throw library_dimension_error(WLL_CURRENT_FUNCTION + "\nincompatible dimensions");
+    const size_t  k        = x.dimension(1);
+    const size_t* row_idx  = a.row_indices_pointer();
+    const auto*   columns  = a.columns_pointer();
+    const T*      values   = a.values_pointer();
+    const T*      x_ptr    = x.data();
+    const T       implicit = a.implicit_value();
+    std::vector<T> implicit_sums(k, T{});
+    if (implicit != T{} && x.size() > 0)
+    {
+        const list<T> col_sums = sum<0>(x);
+        for (size_t j = 0; j < k; ++j)
+            implicit_sums[j] = implicit * col_sums[j];
+    }
+
+    T* y = y_out.data();
+    _for_each_row_part(a, [&](size_t first, size_t last)
+    {
+        for (size_t i_row = first; i_row < last; ++i_row)
         {
-            ptrdiff_t diff = this->idx_[Level] - other.idx_[Level];
-            if (diff < 0)
-                return true;
-            else if (diff > 0)
-                return false;
-            else
-                return cmp_less<Level + 1>(other);
+            T* y_row = y + i_row * k;
+            std::copy_n(implicit_sums.data(), k, y_row);
+            for (size_t i_nz = row_idx[i_row]; i_nz < row_idx[i_row + 1]; ++i_nz)
+            {
+                const T  coeff = values[i_nz] - implicit;
+                const T* x_row = x_ptr + (columns[i_nz][0] - 1) * k;
+                for (size_t j = 0; j < k; ++j)
+                    y_row[j] += coeff * x_row[j];
+            }
         }
-        else
+    });
+}
+
+template<typename T>
+matrix<T> multiply(const sparse_array<T, 2>& a, const matrix<T>& x, memory_type access = memory_type::result)
+{
+    matrix<T> ret({a.dimension(0), x.dimension(1)}, uninitialized, access);
+    multiply(a, x, ret);
+    return ret;
+}
+
+// number of private accumulators of products with Transpose[a]; it depends only on the matrix,
+// so that results do not depend on the number of threads, and their size is bounded by the
+// explicit elements
+template<typename T>
+size_t _transpose_num_parts(const sparse_array<T, 2>& a)
+{
+    constexpr size_t max_parts = 16;
+    const size_t rows = a.dimension(0);
+    const size_t cols = std::max(a.dimension(1), size_t(1));
+    return std::max(size_t(1), std::min({max_parts, rows, a.row_indices_pointer()[rows] / cols}));
+}
+
+// Transpose[a] . x; each range of rows scatters into its own accumulator, and the accumulators
+// are summed in order; for repeated products, multiply(a.transpose(), x) avoids the scatter
+template<typename T>
+void multiply_transpose(const sparse_array<T, 2>& a, const list<T>& x, list<T>& y_out)
+{
+    if (a.dimension(0) != x.size() || a.dimension(1) != y_out.size())
+        throw library_dimension_error(WLL_CURRENT_FUNCTION + "\nincompatible dimensions");
+    const size_t  rows     = a.dimension(0);
+    const size_t  cols     = a.dimension(1);
+    const size_t* row_idx  = a.row_indices_pointer();
+    const auto*   columns  = a.columns_pointer();
+    const T*      values   = a.values_pointer();
+    const T*      x_ptr    = x.data();
+    const T       implicit = a.implicit_value();
+    const T       implicit_sum = (implicit == T{} || rows == 0) ? T{} : implicit * sum(x);
+
+    const size_t num_parts = _transpose_num_parts(a);
+    const std::vector<size_t> bounds = _balanced_row_parts(row_idx, rows, num_parts);
+    _owned_vector<T> partial(num_parts * cols);
+    parallel_for(0, num_parts, [&](size_t first, size_t last)
+    {
+        for (size_t part = first; part < last; ++part)
         {
-            return this->idx_[Level] < other.idx_[Level];
+            T* acc = partial.data() + part * cols;
+            std::fill_n(acc, cols, T{});
+            for (size_t i_row = bounds[part]; i_row < bounds[part + 1]; ++i_row)
+                for (size_t i_nz = row_idx[i_row]; i_nz < row_idx[i_row + 1]; ++i_nz)
+                    acc[columns[i_nz][0] - 1] += (values[i_nz] - implicit) * x_ptr[i_row];
         }
-    }
+    }, 1);
 
-    template<size_t Level = 0>
-    bool cmp_greater(const _my_type& other) const
+    T* y = y_out.data();
+    parallel_for(0, cols, [&](size_t first, size_t last)
     {
-        if constexpr (Level + 1 < _rank)
+        for (size_t col = first; col < last; ++col)
         {
-            ptrdiff_t diff = this->idx_[Level] - other.idx_[Level];
-            if (diff > 0)
-                return true;
-            else if (diff < 0)
-                return false;
-            else
-                return cmp_greater<Level + 1>(other);
+            T total = partial[col];
+            for (size_t part = 1; part < num_parts; ++part)
+                total += partial[part * cols + col];
+            y[col] = implicit_sum + total;
         }
-        else
+    });
+}
+
+template<typename T>
+list<T> multiply_transpose(const sparse_array<T, 2>& a, const list<T>& x,
+                           memory_type access = memory_type::result)
+{
+    list<T> ret({a.dimension(1)}, uninitialized, access);
+    multiply_transpose(a, x, ret);
+    return ret;
+}
+
+template<typename T>
+void multiply_transpose(const sparse_array<T, 2>& a, const matrix<T>& x, matrix<T>& y_out)
+{
+    if (a.dimension(0) != x.dimension(0) || a.dimension(1) != y_out.dimension(0) ||
+        x.dimension(1) != y_out.dimension(1))
+        throw library_dimension_error(WLL_CURRENT_FUNCTION + "\nincompatible dimensions");
+    const size_t  rows     = a.dimension(0);
+    const size_t  cols     = a.dimension(1);
+    const size_t  k        = x.dimension(1);
+    const size_t* row_idx  = a.row_indices_pointer();
+    const auto*   columns  = a.columns_pointer();
+    const T*      values   = a.values_pointer();
+    const T*      x_ptr    = x.data();
+    const T       implicit = a.implicit_value();
+    std::vector<T> implicit_sums(k, T{});
+    if (implicit != T{} && x.size() > 0)
+    {
+        const list<T> col_sums = sum<0>(x);
+        for (size_t j = 0; j < k; ++j)
+            implicit_sums[j] = implicit * col_sums[j];
+    }
+
+    const size_t num_parts = _transpose_num_parts(a);
+    const size_t part_size = cols * k;
+    const std::vector<size_t> bounds = _balanced_row_parts(row_idx, rows, num_parts);
+    _owned_vector<T> partial(num_parts * part_size);
+    parallel_for(0, num_parts, [&](size_t first, size_t last)
+    {
+        for (size_t part = first; part < last; ++part)
         {
-            return this->idx_[Level] > other.idx_[Level];
+            T* acc = partial.data() + part * part_size;
+            std::fill_n(acc, part_size, T{});
+            for (size_t i_row = bounds[part]; i_row < bounds[part + 1]; ++i_row)
+            {
+                const T* x_row = x_ptr + i_row * k;
+                for (size_t i_nz = row_idx[i_row]; i_nz < row_idx[i_row + 1]; ++i_nz)
+                {
+                    const T coeff = values[i_nz] - implicit;
+                    T* acc_row = acc + (columns[i_nz][0] - 1) * k;
+                    for (size_t j = 0; j < k; ++j)
+                        acc_row[j] += coeff * x_row[j];
+                }
+            }
         }
-    }
+    }, 1);
 
-private:
-    _sparse_t sparse_;
-    _idx_t    idx_;
-};
+    T* y = y_out.data();
+    parallel_for(0, part_size, [&](size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; ++i)
+        {
+            T total = partial[i];
+            for (size_t part = 1; part < num_parts; ++part)
+                total += partial[part * part_size + i];
+            y[i] = implicit_sums[i % k] + total;
+        }
+    });
+}
+
+template<typename T>
+matrix<T> multiply_transpose(const sparse_array<T, 2>& a, const matrix<T>& x,
+                             memory_type access = memory_type::result)
+{
+    matrix<T> ret({a.dimension(1), x.dimension(1)}, uninitialized, access);
+    multiply_transpose(a, x, ret);
+    return ret;
+}
+
+// a . b for sparse matrices, as a sparse array with implicit value value; the factors must have
+// implicit value zero, and a non-zero value makes every position no product reaches explicit
+template<typename T>
+sparse_array<T, 2> multiply(const sparse_array<T, 2>& a, const sparse_array<T, 2>& b,
+                            T value = T{}, memory_type access = memory_type::owned)
+{
+    return a._multiply_sparse(b, value, access);
+}
 
 
 enum class sparse_passing_by
@@ -2536,6 +7003,28 @@ void submit_result(Ret&& result, MArgument mresult)
         MTensor ret = std::forward<Ret>(result).get_mtensor();
         MArgument_setMTensor(mresult, ret);
     }
+    else if constexpr (is_tensor_expr_v<Ret>)
+    {
+        using mtype = typename derive_tensor_data_type<typename Ret::value_type>::convert_type;
+        static_assert(!std::is_same_v<void, mtype>, "invalid data type to convert to MType");
+        MTensor ret = tensor<mtype, Ret::_rank>(result, memory_type::manual).get_mtensor();
+        MArgument_setMTensor(mresult, ret);
+    }
+    else if constexpr (is_tensor_builder_v<Ret>)
+    {
+        MTensor ret = std::move(result).get_mtensor();
+        MArgument_setMTensor(mresult, ret);
+    }
+    else if constexpr (is_fixed_tensor_v<Ret>)
+    {
+        MTensor ret = result.get_mtensor();
+        MArgument_setMTensor(mresult, ret);
+    }
+    else if constexpr (is_tensor_view_v<Ret>)
+    {
+        MTensor ret = result.get_mtensor();
+        MArgument_setMTensor(mresult, ret);
+    }
     else if constexpr (sparse_passing_category_v<Ret> == sparse_passing_by::value)
     {
         MSparseArray ret = std::forward<Ret>(result).get_msparse();
@@ -2597,9 +7086,19 @@ inline void handle_exception(const std::exception_ptr& eptr) noexcept
     }
 }
 
+struct _scratch_reset_guard
+{
+    ~_scratch_reset_guard()
+    {
+        global_scratch.reset();
+    }
+};
+
 template<typename Ret, typename... Args>
 int library_eval(Ret fn(Args...), mint argc, MArgument* args, MArgument& mresult)
 {
+    _scratch_reset_guard scratch_guard;
+    global_abort.reset();
 #ifndef WLL_DISABLE_EXCEPTION_HANDLING
     try
     {
@@ -2609,9 +7108,19 @@ int library_eval(Ret fn(Args...), mint argc, MArgument* args, MArgument& mresult
         static_assert(!std::is_reference_v<Ret>, "cannot return a reference type");
         auto args_tuple = get_args<Args...>(args);
         if constexpr (std::is_same_v<void, Ret>)
+        {
             tuple_invoke(fn, args_tuple);
+            if (global_abort.requested())
+                throw library_abort_error(WLL_CURRENT_FUNCTION + "\ncomputation aborted.");
+        }
         else
-            submit_result(tuple_invoke(fn, args_tuple), mresult);
+        {
+            auto result = tuple_invoke(fn, args_tuple);
+            // an aborted result is dropped before it is handed to the kernel
+            if (global_abort.requested())
+                throw library_abort_error(WLL_CURRENT_FUNCTION + "\ncomputation aborted.");
+            submit_result(std::move(result), mresult);
+        }
 
 #ifndef WLL_DISABLE_EXCEPTION_HANDLING
     }
@@ -2626,13 +7135,218 @@ int library_eval(Ret fn(Args...), mint argc, MArgument* args, MArgument& mresult
 }
 
 
+template<typename Arg>
+int _tensor_arg_mtype(MArgument arg)
+{
+    if constexpr (tensor_passing_category_v<Arg> != tensor_passing_by::unknown)
+        return int(global_lib_data->MTensor_getType(MArgument_getMTensor(arg)));
+    else
+        return MType_Void;
+}
+
+template<typename... Args, size_t... Is>
+int _tensor_args_mtype_impl(MArgument* args, std::index_sequence<Is...>)
+{
+    int mtype = MType_Void;
+    ((mtype = std::max(mtype, _tensor_arg_mtype<Args>(args[Is]))), ...);
+    return mtype;
+}
+
+// the widest MType of the tensor arguments, as MType_Integer < MType_Real < MType_Complex
+template<typename Ret, typename... Args>
+int _tensor_args_mtype(Ret (*)(Args...), MArgument* args)
+{
+    static_assert(((tensor_passing_category_v<Args> != tensor_passing_by::unknown) || ...),
+                  "function should have a tensor parameter to dispatch on");
+    return _tensor_args_mtype_impl<Args...>(args, std::index_sequence_for<Args...>{});
+}
+
+// call the instantiation for mint, double or std::complex<double> of a function template,
+// so that tensor arguments of that type are passed without conversion; with mixed types
+// the widest one is used, and fn_complex can be nullptr if complex data is not supported
+template<typename FnInteger, typename FnReal, typename FnComplex>
+int library_eval_by_type(FnInteger fn_integer, FnReal fn_real, FnComplex fn_complex,
+                         mint argc, MArgument* args, MArgument& mresult)
+{
+    const int mtype = _tensor_args_mtype(fn_integer, args);
+    if (mtype == MType_Integer)
+        return library_eval(fn_integer, argc, args, mresult);
+    if (mtype == MType_Real)
+        return library_eval(fn_real, argc, args, mresult);
+    if constexpr (std::is_null_pointer_v<FnComplex>)
+    {
+        handle_exception(std::make_exception_ptr(
+            library_type_error(WLL_CURRENT_FUNCTION + "\ncomplex arguments are not supported.")));
+        return global_exception.error_type_;
+    }
+    else
+    {
+        return library_eval(fn_complex, argc, args, mresult);
+    }
+}
+
+// shape of the result of a listable function: that of the argument with the highest rank,
+// the largest one among those; every other argument should have its trailing dimensions
+// or a single element, and is repeated to fill the shape as in expressions
+inline const std::vector<size_t>& _listable_dims(const std::vector<size_t>* const* dims, size_t count)
+{
+    WLL_ASSERT(count > 0);
+    const std::vector<size_t>* ret = dims[0];
+    for (size_t k = 1; k < count; ++k)
+        if (dims[k]->size() > ret->size() ||
+            (dims[k]->size() == ret->size() && _flattened_size(*dims[k]) > _flattened_size(*ret)))
+            ret = dims[k];
+    for (size_t k = 0; k < count; ++k)
+    {
+        const bool is_trailing = std::equal(dims[k]->rbegin(), dims[k]->rend(), ret->rbegin());
+        if (!is_trailing && _flattened_size(*dims[k]) != 1)
+            throw library_dimension_error(WLL_CURRENT_FUNCTION + "\narguments cannot be threaded together.");
+    }
+    return *ret;
+}
+
+template<typename Arg>
+using _listable_arg_t = std::remove_cv_t<std::remove_reference_t<Arg>>;
+
+template<auto Fn, typename FnType = decltype(Fn)>
+struct _listable;
+
+// entry point threading the scalar function Fn over tensor arguments in parallel,
+// see DEFINE_WLL_LISTABLE_FUNCTION
+template<auto Fn, typename Ret, typename... Args>
+struct _listable<Fn, Ret(*)(Args...)>
+{
+    using _mtype_t    = typename derive_tensor_data_type<Ret>::convert_type;
+    using result_type = std::conditional_t<std::is_same_v<_mtype_t, mcomplex>, std::complex<double>, _mtype_t>;
+    static_assert(sizeof...(Args) > 0, "a listable function needs at least one argument");
+    static_assert((_is_expr_scalar_v<_listable_arg_t<Args>> && ...),
+                  "arguments of a listable function should be of scalar types");
+    static_assert(!std::is_void_v<result_type>, "invalid data type to convert to MType");
+
+    static any_tensor<result_type> eval(const any_tensor<_listable_arg_t<Args>>&... args)
+    {
+        return _eval_impl(std::index_sequence_for<Args...>{}, args...);
+    }
+
+    template<size_t... Is>
+    static any_tensor<result_type> _eval_impl(std::index_sequence<Is...>,
+                                              const any_tensor<_listable_arg_t<Args>>&... args)
+    {
+        constexpr size_t num_args = sizeof...(Args);
+        const std::array<const std::vector<size_t>*, num_args> dims = {&args.dimensions()...};
+        const std::array<size_t, num_args> sizes = {args.size()...};
+        const auto ptrs = std::make_tuple(args.data()...);
+
+        any_tensor<result_type> result(_listable_dims(dims.data(), num_args), uninitialized,
+                                       memory_type::result);
+        result_type* dest = result.data();
+        parallel_for(0, result.size(), [&](size_t first, size_t last)
+        {
+            std::array<size_t, num_args> idx = {(first % sizes[Is])...};
+            for (size_t i = first; i < last; ++i)
+            {
+                dest[i] = _mtype_cast<result_type>(Fn(std::get<Is>(ptrs)[idx[Is]]...));
+                ((idx[Is] = (idx[Is] + 1 == sizes[Is]) ? 0 : idx[Is] + 1), ...);
+            }
+        });
+        return result;
+    }
+};
+
+// queries the kernel directly and only on the calling thread, see abort_token for loops
 inline bool has_abort() noexcept
 {
     return bool(global_lib_data->AbortQ());
 }
 
+
+// instruction sets that kernels can be specialized for, from the least capable up
+enum class isa_level
+{
+    generic, // whatever the library is compiled for
+    avx2,    // AVX2 and FMA
+    avx512,  // AVX-512 F, DQ, BW and VL
+    _count
+};
+
+// attributes compiling a single function for an isa_level, e.g.
+// WLL_TARGET_AVX2 void kernel_avx2(...); MSVC accepts the intrinsics without them
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define WLL_TARGET_AVX2   __attribute__((target("avx2,fma")))
+#define WLL_TARGET_AVX512 __attribute__((target("avx2,fma,avx512f,avx512dq,avx512bw,avx512vl")))
+#else
+#define WLL_TARGET_AVX2
+#define WLL_TARGET_AVX512
+#endif
+
+// the most capable isa_level supported by both the CPU and the operating system
+inline isa_level detect_isa_level() noexcept
+{
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq") &&
+        __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl"))
+        return isa_level::avx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return isa_level::avx2;
+    return isa_level::generic;
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int info[4];
+    __cpuid(info, 0);
+    const int max_leaf = info[0];
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool fma     = (info[2] & (1 << 12)) != 0;
+    if (!osxsave || max_leaf < 7)
+        return isa_level::generic;
+    const unsigned long long xcr0 = _xgetbv(0);
+    __cpuidex(info, 7, 0);
+    const bool ymm_state = (xcr0 & 0x06) == 0x06;
+    const bool zmm_state = (xcr0 & 0xE6) == 0xE6;
+    const bool avx2      = (info[1] & (1 << 5)) != 0;
+    const bool avx512    = (info[1] & (1 << 16)) && (info[1] & (1 << 17)) &&
+                           (info[1] & (1 << 30)) && (info[1] & (1u << 31));
+    if (zmm_state && avx512 && avx2 && fma)
+        return isa_level::avx512;
+    if (ymm_state && avx2 && fma)
+        return isa_level::avx2;
+    return isa_level::generic;
+#else
+    return isa_level::generic;
+#endif
+}
+
+// set by WolframLibrary_initialize
+inline isa_level global_isa_level = isa_level::generic;
+
+using _entry_point_t = int (*)(WolframLibraryData, mint, MArgument*, MArgument);
+
+struct _isa_dispatch_entry
+{
+    _entry_point_t* target_;
+    std::array<_entry_point_t, size_t(isa_level::_count)> entries_;
+};
+
+// entry points of DEFINE_WLL_ISA_FUNCTION, pointed at their best version on initialization
+inline std::vector<_isa_dispatch_entry> global_isa_dispatch;
+
+inline bool _register_isa_dispatch(_entry_point_t* target,
+                                   const std::array<_entry_point_t, size_t(isa_level::_count)>& entries)
+{
+    *target = entries[size_t(isa_level::generic)];
+    global_isa_dispatch.push_back({target, entries});
+    return true;
+}
+
+inline void _select_isa_dispatch(isa_level level) noexcept
+{
+    for (const auto& entry : global_isa_dispatch)
+        *entry.target_ = entry.entries_[size_t(level)];
+}
+
 }
 
+#ifndef WLL_DISABLE_ENTRY_POINTS
 EXTERN_C DLLEXPORT mint WolframLibrary_getVersion()
 {
     return WolframLibraryVersion;
@@ -2643,9 +7357,15 @@ EXTERN_C DLLEXPORT int WolframLibrary_initialize(WolframLibraryData lib_data)
     wll::global_sparse_fn = wll::global_lib_data->sparseLibraryFunctions;
     wll::global_exception = wll::exception_status{};
     wll::global_log.clear();
+    wll::global_isa_level = wll::detect_isa_level();
+    wll::_select_isa_dispatch(wll::global_isa_level);
     return 0;
 }
-EXTERN_C DLLEXPORT void WolframLibrary_uninitialize(WolframLibraryData){ }
+EXTERN_C DLLEXPORT void WolframLibrary_uninitialize(WolframLibraryData)
+{
+    wll::global_thread_pool.reset();
+    wll::global_scratch.release();
+}
 EXTERN_C DLLEXPORT int wll_exception_msg(WolframLibraryData, mint, MArgument*, MArgument res)
 {
     MArgument_setUTF8String(res, const_cast<char*>(wll::global_exception.message_.c_str()));
@@ -2662,9 +7382,55 @@ EXTERN_C DLLEXPORT int wll_log_clear(WolframLibraryData, mint, MArgument*, MArgu
     wll::global_log.clear();
     return LIBRARY_NO_ERROR;
 }
+#endif
 
 #define DEFINE_WLL_FUNCTION(fn)                                                                 \
 EXTERN_C DLLEXPORT int wll_##fn(WolframLibraryData, mint argc, MArgument* args, MArgument res)  \
 {                                                                                               \
     return wll::library_eval(fn, argc, args, res);                                              \
 }
+
+// entry point taking a tensor for each scalar parameter of fn, of any rank; fn is applied
+// element-wise in parallel and the result is a tensor of the threaded shape, e.g.
+// double f(double, mint) loads as {{Real, _, "Constant"}, {Integer, _, "Constant"}} -> {Real, _}
+#define DEFINE_WLL_LISTABLE_FUNCTION(fn)                                                        \
+EXTERN_C DLLEXPORT int wll_##fn(WolframLibraryData, mint argc, MArgument* args, MArgument res)  \
+{                                                                                               \
+    return wll::library_eval(wll::_listable<fn>::eval, argc, args, res);                        \
+}
+
+// entry point for a function template fn<T> whose tensor parameters have the value type T;
+// T is mint, double or std::complex<double> to match the tensors passed from the kernel
+#define DEFINE_WLL_TEMPLATE_FUNCTION(fn)                                                        \
+EXTERN_C DLLEXPORT int wll_##fn(WolframLibraryData, mint argc, MArgument* args, MArgument res)  \
+{                                                                                               \
+    return wll::library_eval_by_type(                                                           \
+        fn<mint>, fn<double>, fn<std::complex<double>>, argc, args, res);                       \
+}
+
+// as DEFINE_WLL_TEMPLATE_FUNCTION for T = mint and double only, complex tensors are rejected
+#define DEFINE_WLL_REAL_TEMPLATE_FUNCTION(fn)                                                   \
+EXTERN_C DLLEXPORT int wll_##fn(WolframLibraryData, mint argc, MArgument* args, MArgument res)  \
+{                                                                                               \
+    return wll::library_eval_by_type(fn<mint>, fn<double>, nullptr, argc, args, res);          \
+}
+
+// entry point with a version of fn for each isa_level, built with WLL_TARGET_AVX2 and
+// WLL_TARGET_AVX512; the best one for the host is chosen once, in WolframLibrary_initialize.
+// The versions may be in other source files, which must be compiled with the same target
+// flags as the rest: the linker keeps one copy of each inline function of the header, and
+// that copy must run on any host
+#define WLL_ISA_ENTRY(fn)                                                                       \
+[](WolframLibraryData, mint argc, MArgument* args, MArgument res)                               \
+{                                                                                               \
+    return wll::library_eval(fn, argc, args, res);                                              \
+}
+
+#define DEFINE_WLL_ISA_FUNCTION(fn, fn_generic, fn_avx2, fn_avx512)                             \
+static wll::_entry_point_t wll_isa_##fn = nullptr;                                              \
+[[maybe_unused]] static const bool wll_isa_registered_##fn = wll::_register_isa_dispatch(        \
+    &wll_isa_##fn, {WLL_ISA_ENTRY(fn_generic), WLL_ISA_ENTRY(fn_avx2), WLL_ISA_ENTRY(fn_avx512)}); \
+EXTERN_C DLLEXPORT int wll_##fn(WolframLibraryData lib_data, mint argc, MArgument* args, MArgument res) \
+{                                                                                               \
+    return wll_isa_##fn(lib_data, argc, args, res);                                             \
+}